@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# Measure how closely the durations tach records match the real gaps between
+# lines, using emit to send lines on a precise schedule, and check to compare
+# what it logged with a recording of the run. tach's output goes to a pty, so
+# that it is redrawing idle timestamps the whole time, as it would for a user.
+#
+# Prints one tab separated line per case, after a header:
+#
+#   commit    the revision being measured
+#   interval  the time between lines, in microseconds
+#   mode      pty, or pipe for -p
+#   load      how many CPU hogs were running alongside
+#   lines     how many line durations were compared
+#   mean_ns   the mean error, signed, so that it shows any bias
+#   p99_ns    the 99th percentile of the error's magnitude
+#   worst_ns  the largest error
+
+TACH=${TACH:-../tach}
+RUN=./run
+
+# Interval in microseconds, and number of lines, each a couple of seconds long
+CASES=${CASES:-"250000:8 10000:200 1000:2000"}
+
+# Run everything again with a hog for every CPU, to see what contention does
+LOADS=${LOADS:-"0 $(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)"}
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/tach-accuracy.XXXXXX") || exit 1
+hogs=
+trap 'kill $hogs 2>/dev/null; rm -rf "$tmp"' EXIT
+trap 'exit 1' INT TERM
+
+printf 'commit\tinterval\tmode\tload\tlines\tmean_ns\tp99_ns\tworst_ns\n'
+for load in $LOADS; do
+	i=0
+	while [ $i -lt $load ]; do
+		yes > /dev/null &
+		hogs="$hogs $!"
+		i=$((i + 1))
+	done
+
+	for c in $CASES; do
+		interval=${c%%:*}
+		count=${c#*:}
+
+		for mode in pty pipe; do
+			flags=
+			if [ $mode = pipe ]; then
+				flags=-p
+			fi
+
+			$RUN -s pty -- $TACH $flags -o "$tmp/run.tach" \
+			     ./emit "$tmp/sent" $interval $count > /dev/null || exit 1
+			result=$(./check "$tmp/sent" "$tmp/run.tach") || exit 1
+
+			printf '%s\t%s\t%s\t%s\t%s\n' $commit $interval $mode $load \
+			       "$(echo $result | tr ' ' '\t')"
+		done
+	done
+
+	kill $hogs 2>/dev/null
+	wait $hogs 2>/dev/null
+	hogs=
+done
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Measure the throughput and overhead of tach against every generator, with
+# the child on a pty and on pipes, and with tach writing to /dev/null and to a
+# pty that is read as fast as possible.
+#
+# Prints one tab separated line per case, after a header, so that runs from
+# different commits can be compared with any tool that reads columns:
+#
+#   commit    the revision being measured
+#   gen       which generator, see gen.c
+#   mode      pty, or pipe for -p
+#   sink      where tach's output went, null or pty
+#   lines     lines, and bytes, produced by the generator
+#   bytes
+#   raw_ns    wall time of the generator on its own, into the same sink
+#   wall_ns   wall time of the generator under tach
+#   cpu_ns    CPU time, user and system, used by tach itself. It never reaps
+#             the generator, so that isn't counted along with it
+#   lines_s   lines, and bytes, per second of wall time under tach
+#   bytes_s
+#   over_ns   wall time tach added to the run
+#
+# Each case takes the fastest of $REPS runs, to keep the noise down.
+
+TACH=${TACH:-../tach}
+REPS=${REPS:-3}
+GEN=./gen
+RUN=./run
+
+# Sizes are picked for each run to take a fraction of a second, raw
+CASES=${CASES:-"short:1000000 long:20000 cr:20000 mixed:100000 dribble:20000"}
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+# The fastest of $REPS runs of a command, as "wall_ns cpu_ns"
+best() {
+	i=0
+	while [ $i -lt $REPS ]; do
+		$RUN "$@" || exit 1
+		i=$((i + 1))
+	done | awk '{
+		if ($4 != 0) { print "exit status " $4 > "/dev/stderr"; exit 1 }
+		if (!n++ || $1 < wall) { wall = $1; cpu = $2 + $3 }
+	} END { print wall, cpu }'
+}
+
+printf 'commit\tgen\tmode\tsink\tlines\tbytes\traw_ns\twall_ns\tcpu_ns\tlines_s\tbytes_s\tover_ns\n'
+for c in $CASES; do
+	gen=${c%%:*}
+	count=${c#*:}
+	set -- $($GEN -c $gen $count)
+	lines=$1
+	bytes=$2
+
+	for sink in null pty; do
+		raw=$(best -s $sink -- $GEN $gen $count) || exit 1
+
+		for mode in pty pipe; do
+			flags=
+			if [ $mode = pipe ]; then
+				flags=-p
+			fi
+
+			run=$(best -s $sink -- $TACH $flags $GEN $gen $count) || exit 1
+
+			echo "$commit $gen $mode $sink $lines $bytes $raw $run" | awk -v OFS='\t' '{
+				wall = $9
+				secs = wall / 1e9
+				printf "%s\t%s\t%s\t%s\t%d\t%d\t%d\t%d\t%d\t%.0f\t%.0f\t%d\n",
+				       $1, $2, $3, $4, $5, $6, $7, wall, $10,
+				       $5 / secs, $6 / secs, wall - $7
+			}'
+		done
+	done
+done
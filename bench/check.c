@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * Compare the line durations in a recording with the gaps between the send
+ * times logged by emit, and print how far off they were, in nanoseconds:
+ *
+ *     lines mean_error p99_jitter worst_jitter
+ *
+ * The first line is left out, since its duration is measured from when tach
+ * started rather than from another line. Error is signed, so the mean shows
+ * any bias, while jitter is its magnitude.
+ */
+
+#include "../src/record.h"
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+static int compare(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char * const argv[]) {
+	if (argc != 3) {
+		errx(EX_USAGE, "usage: %s log recording", argv[0]);
+	}
+
+	FILE *log = fopen(argv[1], "r");
+	if (!log) {
+		err(EX_NOINPUT, "%s", argv[1]);
+	}
+	struct recording *r = rec_map(argv[2]);
+
+	size_t n = 0;
+	int64_t sum = 0;
+	uint64_t *jitter = malloc(r->size / sizeof(struct rec_line) * sizeof(uint64_t));
+	if (!jitter) {
+		err(EX_OSERR, "malloc");
+	}
+
+	unsigned long long sent, prev = 0;
+	size_t cursor = 0;
+	const struct rec_line *lines;
+	size_t count;
+	while (rec_chunk(r, &cursor, &lines, &count)) {
+		for (size_t i = 0; i < count; i++) {
+			if (fscanf(log, "%llu", &sent) != 1) {
+				errx(EX_DATAERR, "%s: more lines were recorded than sent", argv[2]);
+			}
+			if (lines[i].index) {
+				const int64_t error = (int64_t)lines[i].duration - (int64_t)(sent - prev);
+				sum += error;
+				jitter[n++] = (uint64_t)(error < 0 ? -error : error);
+			}
+			prev = sent;
+		}
+	}
+	if (fscanf(log, "%llu", &sent) == 1) {
+		errx(EX_DATAERR, "%s: fewer lines were recorded than sent", argv[2]);
+	}
+	if (!n) {
+		errx(EX_DATAERR, "%s: at least two lines are needed", argv[2]);
+	}
+
+	qsort(jitter, n, sizeof(uint64_t), compare);
+	printf("%zu %lld %llu %llu\n", n, (long long)(sum / (int64_t)n),
+	       (unsigned long long)jitter[(n - 1) * 99 / 100],
+	       (unsigned long long)jitter[n - 1]);
+
+	free(jitter);
+	fclose(log);
+	rec_unmap(r);
+	return EX_OK;
+}
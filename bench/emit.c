@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * Write lines on a fixed schedule of absolute deadlines, so that lateness in
+ * one line doesn't push back the ones after it, and log when each one was
+ * actually sent, as nanoseconds on the monotonic clock, one per line.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC  (1000000000ULL)
+#define NSEC_PER_USEC (1000ULL)
+
+static uint64_t nsec(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+static __attribute__((noreturn)) void usage(const char *progname) {
+	errx(EX_USAGE, "usage: %s log interval_usec count", progname);
+}
+
+static unsigned long number(const char *str, const char *progname) {
+	char *end;
+	const unsigned long result = strtoul(str, &end, 10);
+	if (!*str || *end) {
+		warnx("Invalid number: %s", str);
+		usage(progname);
+	}
+	return result;
+}
+
+int main(int argc, char * const argv[]) {
+	if (argc != 4) {
+		usage(argv[0]);
+	}
+
+	FILE *log = fopen(argv[1], "w");
+	if (!log) {
+		err(EX_CANTCREAT, "%s", argv[1]);
+	}
+	const uint64_t interval = number(argv[2], argv[0]) * NSEC_PER_USEC;
+	const unsigned long count = number(argv[3], argv[0]);
+
+	/* Keep the send times in memory, so logging them can't get in the way */
+	uint64_t *sent = malloc(count * sizeof(uint64_t));
+	if (!sent) {
+		err(EX_OSERR, "malloc");
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t deadline = nsec(&now);
+
+	char line[32];
+	for (unsigned long i = 0; i < count; i++) {
+		deadline += interval;
+		const struct timespec at = {
+			.tv_sec = (time_t)(deadline / NSEC_PER_SEC),
+			.tv_nsec = (long)(deadline % NSEC_PER_SEC),
+		};
+		int rc;
+		while ((rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL)) == EINTR);
+		if (rc) {
+			errno = rc;
+			err(EX_OSERR, "clock_nanosleep");
+		}
+
+		const int len = snprintf(line, sizeof(line), "line %lu\n", i);
+
+		/* The line is only sent once the write returns */
+		if (write(STDOUT_FILENO, line, (size_t)len) != len) {
+			err(EX_IOERR, "write");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		sent[i] = nsec(&now);
+	}
+
+	for (unsigned long i = 0; i < count; i++) {
+		fprintf(log, "%llu\n", (unsigned long long)sent[i]);
+	}
+	if (fclose(log)) {
+		err(EX_IOERR, "%s", argv[1]);
+	}
+	free(sent);
+	return EX_OK;
+}
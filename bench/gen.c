@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * Output generators for benchmarking, each producing a fixed, repeatable
+ * amount of output as fast as it can be written.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#define LONG_WIDTH  (1000) /* wraps several times on any terminal */
+#define BAR_WIDTH   (50)
+#define BAR_STEPS   (20) /* redraws of each progress bar before it's done */
+
+struct out {
+	/** Just add up what would have been written, rather than writing it */
+	bool counting;
+	uint64_t lines;
+	uint64_t bytes;
+
+	/** Pending output for each of stdout and stderr */
+	size_t len[2];
+	char buf[2][64 * 1024];
+};
+
+static void flush(struct out *o, int fd) {
+	const char *p = o->buf[fd - STDOUT_FILENO];
+	size_t *len = o->len + (fd - STDOUT_FILENO);
+
+	while (*len) {
+		const ssize_t cur = write(fd, p, *len);
+		if (cur == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EX_IOERR, "write");
+		}
+		p += cur;
+		*len -= (size_t)cur;
+	}
+}
+
+static void put(struct out *o, int fd, const char *data, size_t len) {
+	o->bytes += len;
+	for (size_t i = 0; i < len; i++) {
+		o->lines += data[i] == '\n';
+	}
+	if (o->counting) {
+		return;
+	}
+
+	const size_t which = (size_t)(fd - STDOUT_FILENO);
+	if (o->len[which] + len > sizeof(o->buf[which])) {
+		flush(o, fd);
+	}
+	memcpy(o->buf[which] + o->len[which], data, len);
+	o->len[which] += len;
+}
+
+/* Lots of short lines */
+static void gen_short(struct out *o, unsigned long count) {
+	char line[32];
+	for (unsigned long i = 0; i < count; i++) {
+		const int len = snprintf(line, sizeof(line), "short line %08lu\n", i);
+		put(o, STDOUT_FILENO, line, (size_t)len);
+	}
+}
+
+/* Lines far wider than the terminal, so that every one of them wraps */
+static void gen_long(struct out *o, unsigned long count) {
+	char line[LONG_WIDTH + 1];
+	for (size_t i = 0; i < LONG_WIDTH; i++) {
+		line[i] = (char)('a' + i % 26);
+	}
+	line[LONG_WIDTH] = '\n';
+
+	for (unsigned long i = 0; i < count; i++) {
+		put(o, STDOUT_FILENO, line, sizeof(line));
+	}
+}
+
+/* Progress bars, each redrawn in place with carriage returns until it fills */
+static void gen_cr(struct out *o, unsigned long count) {
+	char bar[BAR_WIDTH + 16];
+	for (unsigned long i = 0; i < count; i++) {
+		for (int step = 1; step <= BAR_STEPS; step++) {
+			const int filled = step * BAR_WIDTH / BAR_STEPS;
+			const int len = snprintf(bar, sizeof(bar), "\r[%.*s%*s] %3d%%",
+			                         filled, "##################################################",
+			                         BAR_WIDTH - filled, "", step * 100 / BAR_STEPS);
+			put(o, STDOUT_FILENO, bar, (size_t)len);
+		}
+		put(o, STDOUT_FILENO, "\n", 1);
+	}
+}
+
+/* Lines alternating between stdout and stderr, written as they're made */
+static void gen_mixed(struct out *o, unsigned long count) {
+	char line[32];
+	for (unsigned long i = 0; i < count; i++) {
+		const int fd = i % 2 ? STDERR_FILENO : STDOUT_FILENO;
+		const int len = snprintf(line, sizeof(line), "%s line %08lu\n",
+		                         i % 2 ? "stderr" : "stdout", i);
+		put(o, fd, line, (size_t)len);
+		if (!o->counting) {
+			flush(o, fd);
+		}
+	}
+}
+
+/* Short lines written out a single byte at a time */
+static void gen_dribble(struct out *o, unsigned long count) {
+	char line[32];
+	for (unsigned long i = 0; i < count; i++) {
+		const int len = snprintf(line, sizeof(line), "dribble %08lu\n", i);
+		for (int c = 0; c < len; c++) {
+			put(o, STDOUT_FILENO, line + c, 1);
+			if (!o->counting) {
+				flush(o, STDOUT_FILENO);
+			}
+		}
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*gen)(struct out *o, unsigned long count);
+} generators[] = {
+	{ "short", gen_short },
+	{ "long", gen_long },
+	{ "cr", gen_cr },
+	{ "mixed", gen_mixed },
+	{ "dribble", gen_dribble },
+};
+
+static __attribute__((noreturn)) void usage(const char *progname) {
+	errx(EX_USAGE, "usage: %s [-c] short|long|cr|mixed|dribble count", progname);
+}
+
+int main(int argc, char * const argv[]) {
+	static struct out o;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "c")) != -1) {
+		switch (ch) {
+			case 'c':
+				o.counting = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+
+	char *end;
+	const char *count = argv[optind + 1];
+	const unsigned long n = strtoul(count, &end, 10);
+	if (!*count || *end) {
+		warnx("Invalid count: %s", count);
+		usage(argv[0]);
+	}
+
+	for (size_t i = 0; i < sizeof(generators) / sizeof(*generators); i++) {
+		if (!strcmp(argv[optind], generators[i].name)) {
+			generators[i].gen(&o, n);
+			if (o.counting) {
+				/* What a run would produce, for working out rates */
+				printf("%lu %lu\n", (unsigned long)o.lines, (unsigned long)o.bytes);
+			} else {
+				flush(&o, STDOUT_FILENO);
+				flush(&o, STDERR_FILENO);
+			}
+			return EX_OK;
+		}
+	}
+
+	warnx("Unknown generator: %s", argv[optind]);
+	usage(argv[0]);
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * Run a command with its output going to a sink, and report how long it took
+ * and how much CPU time it used, on a single line of space separated numbers:
+ *
+ *     wall_ns user_ns sys_ns exit_status
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC  (1000000000ULL)
+#define NSEC_PER_USEC (1000ULL)
+
+/* The size of the pretend terminal that a pty sink gets */
+#define SINK_COLS (120)
+#define SINK_ROWS (40)
+
+static uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t tv_nsec(struct timeval tv) {
+	return (uint64_t)tv.tv_sec * NSEC_PER_SEC + (uint64_t)tv.tv_usec * NSEC_PER_USEC;
+}
+
+/*
+ * Open a pty to stand in for a terminal, that reads everything written to it
+ * as quickly as it can. Returns the master side, and the slave through sink.
+ */
+static int pty(int *sink) {
+	int master;
+	char *slave;
+	if ((master = posix_openpt(O_RDWR|O_NOCTTY)) < 0 ||
+	    grantpt(master) || unlockpt(master) ||
+	    !(slave = ptsname(master)) ||
+	    (*sink = open(slave, O_RDWR|O_NOCTTY)) < 0) {
+		err(EX_OSERR, "pty");
+	}
+
+	/* Nothing should be translated on the way through */
+	struct termios t;
+	if (!tcgetattr(*sink, &t)) {
+		cfmakeraw(&t);
+		tcsetattr(*sink, TCSANOW, &t);
+	}
+
+	const struct winsize w = { .ws_row = SINK_ROWS, .ws_col = SINK_COLS };
+	ioctl(*sink, TIOCSWINSZ, &w);
+
+	return master;
+}
+
+static __attribute__((noreturn)) void usage(const char *progname) {
+	errx(EX_USAGE, "usage: %s [-s null|pty] [--] command [arg0 ...]", progname);
+}
+
+int main(int argc, char * const argv[]) {
+	const char *kind = "null";
+
+	int ch;
+	while ((ch = getopt(argc, argv, "s:")) != -1) {
+		switch (ch) {
+			case 's':
+				kind = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+	}
+
+	int master = -1, sink;
+	if (!strcmp(kind, "pty")) {
+		master = pty(&sink);
+	} else if (!strcmp(kind, "null")) {
+		if ((sink = open("/dev/null", O_WRONLY)) < 0) {
+			err(EX_OSERR, "/dev/null");
+		}
+	} else {
+		warnx("Unknown sink: %s", kind);
+		usage(argv[0]);
+	}
+
+	const uint64_t start = now();
+	const pid_t pid = fork();
+	switch (pid) {
+		case -1:
+			err(EX_OSERR, "fork");
+		case 0:
+			dup2(sink, STDOUT_FILENO);
+			dup2(sink, STDERR_FILENO);
+			close(sink);
+			if (master != -1) {
+				close(master);
+			}
+			execvp(argv[optind], argv + optind);
+			err(EX_OSERR, "%s", argv[optind]);
+	}
+	close(sink);
+
+	/* Keep the pty drained until every last writer has gone away */
+	if (master != -1) {
+		char buf[64 * 1024];
+		ssize_t cur;
+		while ((cur = read(master, buf, sizeof(buf))) > 0 ||
+		       (cur == -1 && errno == EINTR));
+	}
+
+	int status;
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) == -1) {
+		if (errno != EINTR) {
+			err(EX_OSERR, "wait4");
+		}
+	}
+	const uint64_t wall = now() - start;
+
+	printf("%llu %llu %llu %d\n", (unsigned long long)wall,
+	       (unsigned long long)tv_nsec(usage.ru_utime),
+	       (unsigned long long)tv_nsec(usage.ru_stime),
+	       WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	return EX_OK;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "baseline.h"
+#include "hash.h"
+#include "linebuffer.h"
+#include "record.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+/* Every line with the same normalized text */
+struct entry {
+	uint64_t hash;
+	/** Where their durations start, how many there are, and how many matched */
+	uint32_t first;
+	uint32_t count;
+	uint32_t seen;
+};
+
+struct baseline {
+	struct recording *rec;
+	/** Hashed by normalized text, which is never kept, only its hash */
+	struct entry *table;
+	size_t size;
+	size_t count;
+	/** Every line's duration, in order, with each entry's lines together */
+	uint64_t *durations;
+};
+
+static inline bool digit(unsigned char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline bool hex(unsigned char c) {
+	return digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static inline bool word(unsigned char c) {
+	return hex(c) || (c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z') || c == '_';
+}
+
+/* Hash a line's text the way that it's normalized, without copying it */
+static uint64_t normalize(const char *text, size_t len) {
+	uint64_t h = FNV_OFFSET;
+	/* The hash as of the start of the current run of non-whitespace */
+	uint64_t token = h;
+	bool space = false;
+
+	for (size_t i = 0; i < len;) {
+		const unsigned char c = (unsigned char)text[i];
+
+		if (c == '\x1b') {
+			i = lb_escape(text, len, i);
+		} else if (c == ' ' || c == '\t') {
+			space = true;
+			i++;
+		} else if (c < ' ' || c == 0x7f) {
+			i++;
+		} else {
+			if (space) {
+				h = token = fnv_mix(h, ' ');
+				space = false;
+			}
+
+			if (c == '/') {
+				/* Only the last component of a path counts */
+				h = fnv_mix(token, '/');
+				i++;
+			} else if (word(c)) {
+				/* A 0x prefix makes it hex, whether or not it has digits */
+				const bool prefixed = i + 2 < len && c == '0' &&
+				                      (text[i + 1] == 'x' || text[i + 1] == 'X') &&
+				                      hex((unsigned char)text[i + 2]);
+				size_t end = prefixed ? i + 2 : i;
+				bool digits = prefixed, allhex = true;
+				while (end < len && word((unsigned char)text[end])) {
+					digits |= digit((unsigned char)text[end]);
+					allhex &= hex((unsigned char)text[end]);
+					end++;
+				}
+
+				if (digits && allhex) {
+					h = fnv_mix(h, '#');
+				} else {
+					/* A number within a word is masked, but the rest of it isn't */
+					for (size_t j = i; j < end; j++) {
+						if (!digit((unsigned char)text[j])) {
+							h = fnv_mix(h, (unsigned char)text[j]);
+						} else if (j == i || !digit((unsigned char)text[j - 1])) {
+							h = fnv_mix(h, '#');
+						}
+					}
+				}
+				i = end;
+			} else {
+				h = fnv_mix(h, c);
+				i++;
+			}
+		}
+	}
+	return h;
+}
+
+/* Find a hash's entry, or the empty slot where it would go */
+static struct entry *find(const struct baseline *b, uint64_t hash) {
+	size_t slot = hash & (b->size - 1);
+	while (b->table[slot].count && b->table[slot].hash != hash) {
+		slot = (slot + 1) & (b->size - 1);
+	}
+	return b->table + slot;
+}
+
+static void grow(struct baseline *b) {
+	const size_t size = b->size ? b->size * 2 : 1024;
+	struct entry *old = b->table;
+	const size_t oldsize = b->size;
+
+	b->table = calloc(size, sizeof(struct entry));
+	if (!b->table) {
+		err(EX_OSERR, "calloc");
+	}
+	b->size = size;
+
+	for (size_t i = 0; i < oldsize; i++) {
+		if (old[i].count) {
+			*find(b, old[i].hash) = old[i];
+		}
+	}
+	free(old);
+}
+
+struct baseline *baseline_open(const char *path) {
+	struct baseline *b = calloc(1, sizeof(struct baseline));
+	if (!b) {
+		err(EX_OSERR, "calloc");
+	}
+	b->rec = rec_map(path);
+	grow(b);
+
+	/* Chunk headers say how many lines there are, without visiting them */
+	size_t cursor = 0, total = 0;
+	const struct rec_line *lines;
+	size_t n;
+	while (rec_chunk(b->rec, &cursor, &lines, &n)) {
+		total += n;
+	}
+	if (total > UINT32_MAX) {
+		errx(EX_DATAERR, "%s: Too many lines for a baseline", path);
+	}
+
+	/* Each line's hash is kept just long enough to put its duration in place */
+	uint64_t *hashes = malloc((total ? total : 1) * sizeof(uint64_t));
+	b->durations = malloc((total ? total : 1) * sizeof(uint64_t));
+	if (!hashes || !b->durations) {
+		err(EX_OSERR, "malloc");
+	}
+
+	/* Count up the lines with each text, only looking at as much as is shown */
+	size_t i = 0;
+	for (cursor = 0; rec_chunk(b->rec, &cursor, &lines, &n);) {
+		for (size_t j = 0; j < n; j++, i++) {
+			const struct rec_line *line = lines + j;
+			hashes[i] = normalize(rec_linetext(b->rec, line),
+			                      line->length < LB_TEXT ? line->length : LB_TEXT);
+
+			/* Keep the table under three quarters full, so probes stay short */
+			if ((b->count + 1) * 4 > b->size * 3) {
+				grow(b);
+			}
+			struct entry *e = find(b, hashes[i]);
+			if (!e->count++) {
+				e->hash = hashes[i];
+				b->count++;
+			}
+		}
+	}
+
+	/* Give each entry its own run of durations, in the order they appeared */
+	uint32_t first = 0;
+	for (size_t k = 0; k < b->size; k++) {
+		b->table[k].first = first;
+		first += b->table[k].count;
+	}
+	i = 0;
+	for (cursor = 0; rec_chunk(b->rec, &cursor, &lines, &n);) {
+		for (size_t j = 0; j < n; j++, i++) {
+			struct entry *e = find(b, hashes[i]);
+			b->durations[e->first + e->seen++] = lines[j].duration;
+		}
+	}
+	for (size_t k = 0; k < b->size; k++) {
+		b->table[k].seen = 0;
+	}
+
+	free(hashes);
+	return b;
+}
+
+void baseline_close(struct baseline *b) {
+	rec_unmap(b->rec);
+	free(b->table);
+	free(b->durations);
+	free(b);
+}
+
+bool baseline_match(struct baseline *b, const char *text, size_t len,
+                    uint64_t *duration) {
+	struct entry *e = find(b, normalize(text, len));
+	if (e->seen == e->count) {
+		return false;
+	}
+	*duration = b->durations[e->first + e->seen++];
+	return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A baseline is the recording of an earlier run, indexed by the text of its
+ * lines, so that each line of this run can be compared with how long the same
+ * line took back then.
+ *
+ * Text is normalized before it's hashed: runs of whitespace count as a single
+ * space, escape codes and control characters don't count at all, numbers and
+ * hex strings are masked, and paths are cut down to their last component. That
+ * way, counters, timestamps, addresses and temporary directories don't stop a
+ * line from matching itself. A line that appears several times is matched in
+ * the order that it appeared, the first time with the first time, and so on.
+ */
+struct baseline;
+
+/* Map a recording, and index its lines, exiting with an error if it isn't one. */
+struct baseline *baseline_open(const char *path);
+void baseline_close(struct baseline *b);
+
+/*
+ * Find how long a line took in the baseline, in nanoseconds. Returns false if
+ * it didn't appear there, or not as many times as it has now.
+ */
+bool baseline_match(struct baseline *b, const char *text, size_t len,
+                    uint64_t *duration);
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "capture.h"
+#include "time.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/*
+ * The ring is big enough to absorb a few seconds of a terminal falling
+ * behind a chatty child. Each read is capped, so that one stream can't hog
+ * the whole thing.
+ */
+#define CAP_RING  (4 * 1024 * 1024)
+#define CAP_READ  (64 * 1024)
+
+/*
+ * How many full reads in a row a non-blocking descriptor gets before the
+ * others have their turn, enough to empty a generously sized pipe.
+ */
+#define CAP_DRAIN 16
+
+/* Round up to keep every header in the ring aligned */
+#define CAP_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/* A header for every read in the ring, followed by its data */
+struct entry {
+	uint64_t when;
+	/** The source descriptor, or -1 to skip to the start of the ring */
+	int fd;
+	uint32_t len;
+};
+
+/* Atomics, in whatever spelling the compiler speaks */
+#define LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SWAP(p, v)   __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define FENCE()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+enum {
+	PIPE_OUT,
+	PIPE_IN,
+};
+
+struct capture {
+	pthread_t thread;
+
+	char *ring;
+	/** Bytes ever produced into, and consumed out of, the ring */
+	uint64_t head;
+	uint64_t tail;
+
+	/** Set by the consumer before sleeping, for the producer to wake */
+	int sleeping;
+	/** Set by the producer when the ring is full, for the consumer to wake */
+	int starved;
+	/** Set to ask the producer to exit */
+	int stop;
+
+	/** Only ever written by the producer, but read by anyone */
+	struct cap_stats stats;
+
+	/** Wakes the consumer when there is data */
+	int data[2];
+	/** Wakes the producer when there is space, or it has to stop */
+	int space[2];
+	/** Hands the producer more descriptors to read from */
+	int ctl[2];
+
+	/** Only ever touched by the producer, once it has been started */
+	struct pollfd *fds;
+	size_t nfds;
+	/** Whether each pollfd can be read again without the risk of blocking */
+	bool *nonblock;
+};
+
+/* The first pollfds are the producer's own pipes, followed by the child's */
+enum {
+	POLL_SPACE,
+	POLL_CTL,
+	POLL_FDS,
+};
+
+static void nudge(int fd) {
+	const char c = 0;
+	while (write(fd, &c, 1) == -1 && errno == EINTR);
+}
+
+static void drain(int fd) {
+	char buf[64];
+	while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+static void mkpipe(int fds[2]) {
+	if (pipe(fds) == -1) {
+		err(EX_OSERR, "pipe");
+	}
+
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+	}
+}
+
+/* Publish an entry, and wake the consumer if it's waiting on one */
+static void publish(struct capture *cap, size_t size) {
+	STORE(&cap->head, cap->head + size);
+	if (SWAP(&cap->sleeping, 0)) {
+		nudge(cap->data[PIPE_IN]);
+	}
+}
+
+/*
+ * Find room for a header and a worthwhile read at the head of the ring,
+ * waiting on the consumer if need be. Returns NULL if asked to stop.
+ */
+static struct entry *reserve(struct capture *cap, size_t *room) {
+	const size_t need = sizeof(struct entry) + CAP_READ;
+
+	for (;;) {
+		const size_t used = (size_t)(cap->head - LOAD(&cap->tail));
+		const size_t pos = (size_t)(cap->head % CAP_RING);
+		const size_t contiguous = CAP_RING - pos;
+
+		if (contiguous < need && CAP_RING - used >= contiguous) {
+			/* Skip the tail end of the ring, and leave a note saying so */
+			if (contiguous >= sizeof(struct entry)) {
+				struct entry *skip = (struct entry *)(cap->ring + pos);
+				skip->fd = -1;
+			}
+			publish(cap, contiguous);
+			continue;
+		}
+
+		if (contiguous >= need && CAP_RING - used >= need) {
+			*room = CAP_READ;
+			return (struct entry *)(cap->ring + pos);
+		}
+
+		/* The ring is full, so wait for the consumer to release something */
+		STORE(&cap->starved, 1);
+		FENCE();
+		if (cap->head - LOAD(&cap->tail) != used) {
+			STORE(&cap->starved, 0);
+			continue;
+		}
+
+		struct pollfd pfd = { .fd = cap->space[PIPE_OUT], .events = POLLIN };
+		while (poll(&pfd, 1, -1) == -1 && errno == EINTR);
+		drain(cap->space[PIPE_OUT]);
+		if (LOAD(&cap->stop)) {
+			return NULL;
+		}
+	}
+}
+
+/* Start polling a descriptor, reusing the slot of a finished one if possible */
+static void watch(struct capture *cap, int fd) {
+	size_t i = POLL_FDS;
+	while (i < cap->nfds && cap->fds[i].fd != -1) {
+		i++;
+	}
+	if (i == cap->nfds) {
+		cap->nfds++;
+		if (!(cap->fds = realloc(cap->fds, cap->nfds * sizeof(struct pollfd))) ||
+		    !(cap->nonblock = realloc(cap->nonblock, cap->nfds * sizeof(bool)))) {
+			err(EX_OSERR, "realloc");
+		}
+	}
+
+	cap->fds[i].fd = fd;
+	cap->fds[i].events = POLLIN;
+	cap->fds[i].revents = 0;
+	cap->nonblock[i] = fcntl(fd, F_GETFL) & O_NONBLOCK;
+}
+
+static void *capture(void *arg) {
+	struct capture *cap = arg;
+
+	/* Signals are the eventloop's business, even ones it starts watching later */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	while (!LOAD(&cap->stop)) {
+		if (poll(cap->fds, (nfds_t)cap->nfds, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EX_OSERR, "poll");
+		}
+
+		if (cap->fds[POLL_SPACE].revents) {
+			drain(cap->space[PIPE_OUT]);
+		}
+
+		for (size_t i = POLL_FDS; i < cap->nfds; i++) {
+			struct pollfd *pfd = cap->fds + i;
+			if (pfd->fd < 0 || !pfd->revents) {
+				continue;
+			}
+
+			/*
+			 * A full read means there's probably more waiting, which a
+			 * non-blocking descriptor can fetch without another poll.
+			 */
+			for (int n = 0; n < CAP_DRAIN; n++) {
+				size_t room;
+				struct entry *e = reserve(cap, &room);
+				if (!e) {
+					return NULL;
+				}
+
+				ssize_t cur;
+				while ((cur = read(pfd->fd, e + 1, room)) == -1 && errno == EINTR);
+
+				/* Timestamp it before anything else gets a chance to happen */
+				e->when = clk_now();
+
+				STORE(&cap->stats.reads, cap->stats.reads + 1);
+				if (cur > 0) {
+					STORE(&cap->stats.bytes, cap->stats.bytes + (uint64_t)cur);
+				}
+
+				if (cur == -1 && errno == EAGAIN) {
+					break;
+				}
+
+				/* Errors and EOF both finish the descriptor for good */
+				e->fd = pfd->fd;
+				e->len = cur > 0 ? (uint32_t)cur : 0;
+				if (cur <= 0) {
+					pfd->fd = -1;
+				}
+
+				publish(cap, sizeof(*e) + CAP_ALIGN(e->len));
+
+				if (cur <= 0 || (size_t)cur < room || !cap->nonblock[i]) {
+					break;
+				}
+			}
+		}
+
+		/* New descriptors go last, since they can move the pollfds around */
+		if (cap->fds[POLL_CTL].revents) {
+			int fd;
+			while (read(cap->ctl[PIPE_OUT], &fd, sizeof(fd)) == sizeof(fd)) {
+				watch(cap, fd);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+struct capture *cap_start(void) {
+	struct capture *cap = calloc(sizeof(struct capture), 1);
+	if (!cap ||
+	    !(cap->ring = malloc(CAP_RING)) ||
+	    !(cap->fds = calloc(POLL_FDS, sizeof(struct pollfd))) ||
+	    !(cap->nonblock = calloc(POLL_FDS, sizeof(bool)))) {
+		err(EX_OSERR, "malloc");
+	}
+
+	mkpipe(cap->data);
+	mkpipe(cap->space);
+	mkpipe(cap->ctl);
+
+	cap->nfds = POLL_FDS;
+	cap->fds[POLL_SPACE].fd = cap->space[PIPE_OUT];
+	cap->fds[POLL_SPACE].events = POLLIN;
+	cap->fds[POLL_CTL].fd = cap->ctl[PIPE_OUT];
+	cap->fds[POLL_CTL].events = POLLIN;
+
+	const int rc = pthread_create(&cap->thread, NULL, capture, cap);
+	if (rc) {
+		errno = rc;
+		err(EX_OSERR, "pthread_create");
+	}
+
+	return cap;
+}
+
+void cap_stop(struct capture *cap) {
+	STORE(&cap->stop, 1);
+	nudge(cap->space[PIPE_IN]);
+	pthread_join(cap->thread, NULL);
+
+	for (int i = 0; i < 2; i++) {
+		close(cap->data[i]);
+		close(cap->space[i]);
+		close(cap->ctl[i]);
+	}
+	free(cap->fds);
+	free(cap->nonblock);
+	free(cap->ring);
+	free(cap);
+}
+
+void cap_watch(struct capture *cap, int fd) {
+	/* Writes this small to a pipe are atomic, so this can't tear */
+	while (write(cap->ctl[PIPE_IN], &fd, sizeof(fd)) == -1) {
+		if (errno != EINTR) {
+			err(EX_OSERR, "write");
+		}
+	}
+}
+
+int cap_fd(const struct capture *cap) {
+	return cap->data[PIPE_OUT];
+}
+
+bool cap_arm(struct capture *cap) {
+	drain(cap->data[PIPE_OUT]);
+
+	STORE(&cap->sleeping, 1);
+	FENCE();
+	if (LOAD(&cap->head) != cap->tail) {
+		SWAP(&cap->sleeping, 0);
+		return false;
+	}
+	return true;
+}
+
+bool cap_next(struct capture *cap, struct chunk *chunk) {
+	for (;;) {
+		if (LOAD(&cap->head) == cap->tail) {
+			return false;
+		}
+
+		/* Follow the producer around the end of the ring */
+		const size_t pos = (size_t)(cap->tail % CAP_RING);
+		const size_t contiguous = CAP_RING - pos;
+		const struct entry *e = (const struct entry *)(cap->ring + pos);
+		if (contiguous < sizeof(struct entry) || e->fd == -1) {
+			cap_release(cap, NULL);
+			continue;
+		}
+
+		chunk->when = e->when;
+		chunk->fd = e->fd;
+		chunk->len = e->len;
+		chunk->data = (const char *)(e + 1);
+		return true;
+	}
+}
+
+void cap_release(struct capture *cap, const struct chunk *chunk) {
+	/* A NULL chunk releases the skipped tail end of the ring */
+	const size_t pos = (size_t)(cap->tail % CAP_RING);
+	const size_t size = chunk ? sizeof(struct entry) + CAP_ALIGN(chunk->len)
+	                          : CAP_RING - pos;
+
+	STORE(&cap->tail, cap->tail + size);
+	if (SWAP(&cap->starved, 0)) {
+		nudge(cap->space[PIPE_IN]);
+	}
+}
+
+void cap_stats(const struct capture *cap, struct cap_stats *stats) {
+	stats->reads = LOAD(&cap->stats.reads);
+	stats->bytes = LOAD(&cap->stats.bytes);
+}
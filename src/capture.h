@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A capture thread does nothing but read(2) from the child's descriptors and
+ * timestamp each read the moment it returns. Reads are handed over to the
+ * main thread through a lock-free single-producer, single-consumer ring, so
+ * the measured timings reflect when the child produced its output, rather
+ * than how quickly the terminal managed to accept the previous line.
+ */
+struct capture;
+
+/* A single timestamped read, as seen by the consumer */
+struct chunk {
+	/** When the read returned, from clk_now */
+	uint64_t when;
+	/** The descriptor it came from */
+	int fd;
+	/** The number of bytes read, where 0 means the descriptor is finished */
+	size_t len;
+	const char *data;
+};
+
+/*
+ * Start a capture thread, with nothing to capture yet. It blocks every signal,
+ * so that they are left to the main thread's eventloop.
+ */
+struct capture *cap_start(void);
+
+/*
+ * Start capturing from a descriptor. Once it is finished, its last chunk has
+ * a length of 0, and only then is it safe to close.
+ */
+void cap_watch(struct capture *cap, int fd);
+
+/* Stop the capture thread, and free everything. */
+void cap_stop(struct capture *cap);
+
+/*
+ * A descriptor to wait on for readability, which signals that there are
+ * chunks to consume. It only becomes readable after cap_arm returns true.
+ */
+int cap_fd(const struct capture *cap);
+
+/*
+ * Ask for a wakeup via cap_fd when the next chunk arrives. Returns false
+ * instead, if there are already chunks waiting to be consumed.
+ */
+bool cap_arm(struct capture *cap);
+
+/*
+ * Peek at the oldest chunk that hasn't been consumed. Returns false if there
+ * are none. The chunk stays valid until it is released with cap_release.
+ */
+bool cap_next(struct capture *cap, struct chunk *chunk);
+void cap_release(struct capture *cap, const struct chunk *chunk);
+
+/* How hard the capture thread has been working so far */
+struct cap_stats {
+	/** Calls to read(2), including ones that came back empty */
+	uint64_t reads;
+	/** Bytes that they read */
+	uint64_t bytes;
+};
+
+/* Take a snapshot of the capture thread's counters, safe while it runs. */
+void cap_stats(const struct capture *cap, struct cap_stats *stats);
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+enum event_type {
+	/** ident is a descriptor that is ready to be read */
+	EVENT_READ,
+	/** ident is the number of a signal that was delivered */
+	EVENT_SIGNAL,
+	/** ident is the pid of a child process that exited */
+	EVENT_EXIT,
+	/** The refresh timer expired */
+	EVENT_TIMER,
+};
+
+struct event {
+	enum event_type type;
+	int ident;
+	/** This flag indicates that the far end of a descriptor has hung up. */
+	bool eof;
+};
+
+/*
+ * An eventloop wraps the native readiness notification mechanism of the
+ * platform: kqueue(2) on the BSDs and macOS, and epoll(7) along with timerfd,
+ * signalfd, and pidfd on Linux.
+ */
+struct eventloop;
+
+struct eventloop *el_create(void);
+void el_destroy(struct eventloop *loop);
+
+void el_watch_fd(struct eventloop *loop, int fd);
+void el_unwatch_fd(struct eventloop *loop, int fd);
+
+/*
+ * Deliver a signal as an event instead of via its default disposition. This
+ * must be called before any threads are started.
+ */
+void el_watch_signal(struct eventloop *loop, int sig);
+
+/*
+ * Put back whatever watching signals changed about how this process gets
+ * them, in a child that is about to exec, so the command it runs gets them
+ * the way it would have without us in between. Only async-signal-safe calls
+ * are made, so this is fine between fork(2) and exec.
+ */
+void el_restore_signals(const struct eventloop *loop);
+
+/*
+ * Reap every child as it exits, not just the watched ones, such as orphans
+ * that were reparented to this process as a subreaper. The watched ones are
+ * still delivered. This must be called before any threads are started.
+ */
+void el_reap_all(struct eventloop *loop);
+
+/*
+ * Deliver a single EVENT_EXIT once the specified child process exits, after
+ * reaping it. Any number of children can be watched at once.
+ */
+void el_watch_child(struct eventloop *loop, pid_t pid);
+
+/*
+ * Arm the refresh timer to fire once, after the specified delay, replacing
+ * whatever it was armed with before. Passing NULL disarms the timer.
+ */
+void el_timer(struct eventloop *loop, const struct timespec *after);
+
+/*
+ * Fill in up to count events that are ready, blocking until there is at least
+ * one unless told not to. Returns the number of events, or -1 on failure, with
+ * errno set.
+ */
+int el_wait(struct eventloop *loop, struct event *events, int count, bool block);
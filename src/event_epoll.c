@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#if defined(__linux__)
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+
+#include "event.h"
+
+/* The largest number of epoll events pulled out of the kernel per el_wait */
+#define EPOLL_MAX (64)
+
+/*
+ * Every descriptor registered with epoll is tagged with what it represents,
+ * so that el_wait can translate it back into an event without a lookup.
+ */
+enum source {
+	SOURCE_FD,
+	SOURCE_SIGNAL,
+	SOURCE_TIMER,
+	SOURCE_CHILD,
+};
+
+#define TAG(src, fd)  (((uint64_t)(src) << 32) | (uint32_t)(fd))
+#define TAG_SRC(tag)  ((enum source)((tag) >> 32))
+#define TAG_FD(tag)   ((int)(uint32_t)(tag))
+
+/* A watched child, and how its exit gets noticed */
+struct child {
+	pid_t pid;
+	/** The pidfd, or -1 when pidfd_open(2) is unavailable, and SIGCHLD is used */
+	int pfd;
+	/** Reaped after a SIGCHLD, but not delivered yet */
+	bool exited;
+};
+
+struct eventloop {
+	int ep;
+	/** The signalfd, or -1 if no signals are being watched. */
+	int sfd;
+	sigset_t signals;
+	/** The signal mask from before any were blocked, for children */
+	sigset_t original;
+	/** The timerfd, or -1 if the timer has never been armed. */
+	int tfd;
+	/** The watched children that haven't been delivered yet. */
+	struct child *children;
+	size_t nchildren;
+	/** How many of them exited, waiting for room in an el_wait. */
+	size_t exited;
+	/** Whether children that aren't watched get reaped too */
+	bool all;
+};
+
+static void add(struct eventloop *loop, enum source src, int fd) {
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u64 = TAG(src, fd),
+	};
+
+	if (epoll_ctl(loop->ep, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		err(EX_OSERR, "epoll_ctl");
+	}
+}
+
+struct eventloop *el_create(void) {
+	struct eventloop *loop = calloc(sizeof(struct eventloop), 1);
+	if (!loop) {
+		err(EX_OSERR, "calloc");
+	}
+
+	if ((loop->ep = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		err(EX_OSERR, "epoll_create1");
+	}
+
+	loop->sfd = -1;
+	loop->tfd = -1;
+	sigemptyset(&loop->signals);
+
+	/*
+	 * Older kernels and libcs lack pidfd_open, so children are noticed with
+	 * SIGCHLD instead. That has to be blocked now, before any threads exist
+	 * that would otherwise take it.
+	 */
+	const int probe = (int)syscall(SYS_pidfd_open, getpid(), 0);
+	if (probe == -1) {
+		el_watch_signal(loop, SIGCHLD);
+	} else {
+		close(probe);
+	}
+
+	return loop;
+}
+
+void el_destroy(struct eventloop *loop) {
+	if (loop->sfd != -1) {
+		close(loop->sfd);
+	}
+	if (loop->tfd != -1) {
+		close(loop->tfd);
+	}
+	for (size_t i = 0; i < loop->nchildren; i++) {
+		if (loop->children[i].pfd != -1) {
+			close(loop->children[i].pfd);
+		}
+	}
+	free(loop->children);
+	close(loop->ep);
+	free(loop);
+}
+
+void el_watch_fd(struct eventloop *loop, int fd) {
+	add(loop, SOURCE_FD, fd);
+}
+
+void el_unwatch_fd(struct eventloop *loop, int fd) {
+	if (epoll_ctl(loop->ep, EPOLL_CTL_DEL, fd, NULL) == -1) {
+		err(EX_OSERR, "epoll_ctl");
+	}
+}
+
+void el_watch_signal(struct eventloop *loop, int sig) {
+	/*
+	 * signalfd only sees signals that are blocked, otherwise the default
+	 * disposition gets them first.
+	 */
+	const bool fresh = loop->sfd == -1;
+	sigaddset(&loop->signals, sig);
+	if (sigprocmask(SIG_BLOCK, &loop->signals, fresh ? &loop->original : NULL) == -1) {
+		err(EX_OSERR, "sigprocmask");
+	}
+
+	loop->sfd = signalfd(loop->sfd, &loop->signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (loop->sfd == -1) {
+		err(EX_OSERR, "signalfd");
+	}
+
+	if (fresh) {
+		add(loop, SOURCE_SIGNAL, loop->sfd);
+	}
+}
+
+void el_restore_signals(const struct eventloop *loop) {
+	if (loop->sfd != -1) {
+		sigprocmask(SIG_SETMASK, &loop->original, NULL);
+	}
+}
+
+/* Note that a watched child was reaped, so it gets delivered */
+static void reaped(struct eventloop *loop, pid_t pid) {
+	for (size_t i = 0; i < loop->nchildren; i++) {
+		struct child *c = loop->children + i;
+		if (c->pid == pid && !c->exited) {
+			c->exited = true;
+			loop->exited++;
+		}
+	}
+}
+
+/*
+ * Notice any children without a pidfd that have exited, after a SIGCHLD, or
+ * every child that has, when they are all being reaped.
+ */
+static void reap(struct eventloop *loop) {
+	if (loop->all) {
+		for (pid_t pid; (pid = waitpid(-1, NULL, WNOHANG)) > 0;) {
+			reaped(loop, pid);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < loop->nchildren; i++) {
+		struct child *c = loop->children + i;
+		if (c->pfd == -1 && !c->exited &&
+		    waitpid(c->pid, NULL, WNOHANG) == c->pid) {
+			c->exited = true;
+			loop->exited++;
+		}
+	}
+}
+
+/*
+ * Stop watching a child, once its exit has been delivered. One with a pidfd
+ * has exited but hasn't been waited on yet, so it's reaped here, the same as
+ * the others were after their SIGCHLD.
+ */
+static pid_t retire(struct eventloop *loop, size_t i) {
+	const pid_t pid = loop->children[i].pid;
+	if (loop->children[i].pfd != -1) {
+		if (!loop->children[i].exited) {
+			waitpid(pid, NULL, WNOHANG);
+		}
+		epoll_ctl(loop->ep, EPOLL_CTL_DEL, loop->children[i].pfd, NULL);
+		close(loop->children[i].pfd);
+	}
+	loop->children[i] = loop->children[--loop->nchildren];
+	return pid;
+}
+
+void el_reap_all(struct eventloop *loop) {
+	/* Orphans only make themselves known through SIGCHLD */
+	loop->all = true;
+	el_watch_signal(loop, SIGCHLD);
+}
+
+void el_watch_child(struct eventloop *loop, pid_t pid) {
+	loop->children = realloc(loop->children, (loop->nchildren + 1) * sizeof(struct child));
+	if (!loop->children) {
+		err(EX_OSERR, "realloc");
+	}
+
+	struct child *c = loop->children + loop->nchildren++;
+	c->pid = pid;
+	c->exited = false;
+
+	/* Without pidfd_open, SIGCHLD was watched when the loop was created */
+	c->pfd = (int)syscall(SYS_pidfd_open, pid, 0);
+	if (c->pfd == -1) {
+		if (!sigismember(&loop->signals, SIGCHLD)) {
+			err(EX_OSERR, "pidfd_open");
+		}
+		/* The child may have already exited before it was watched */
+		reap(loop);
+		return;
+	}
+
+	add(loop, SOURCE_CHILD, c->pfd);
+}
+
+void el_timer(struct eventloop *loop, const struct timespec *after) {
+	if (loop->tfd == -1) {
+		if (!after) {
+			return;
+		}
+
+		loop->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (loop->tfd == -1) {
+			err(EX_OSERR, "timerfd_create");
+		}
+		add(loop, SOURCE_TIMER, loop->tfd);
+	}
+
+	/*
+	 * A zeroed itimerspec disarms the timer, so a delay of zero gets the
+	 * shortest one there is instead.
+	 */
+	struct itimerspec its = {{0, 0}, {0, 0}};
+	if (after) {
+		its.it_value = *after;
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec) {
+			its.it_value.tv_nsec = 1;
+		}
+	}
+
+	if (timerfd_settime(loop->tfd, 0, &its, NULL) == -1) {
+		err(EX_OSERR, "timerfd_settime");
+	}
+}
+
+int el_wait(struct eventloop *loop, struct event *events, int count, bool block) {
+	struct epoll_event triggered[EPOLL_MAX];
+	if (count > EPOLL_MAX) {
+		count = EPOLL_MAX;
+	}
+
+	/* Exits that didn't fit last time are waiting already */
+	if (loop->exited) {
+		block = false;
+	}
+
+	int nev;
+	while ((nev = epoll_wait(loop->ep, triggered, count, block ? -1 : 0)) == -1) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+
+	int n = 0;
+	for (int i = 0; i < nev; i++) {
+		const uint64_t tag = triggered[i].data.u64;
+		struct event *e = events + n;
+		e->ident = TAG_FD(tag);
+		e->eof = triggered[i].events & (EPOLLHUP | EPOLLERR);
+
+		switch (TAG_SRC(tag)) {
+			case SOURCE_FD: {
+				e->type = EVENT_READ;
+			} break;
+			case SOURCE_SIGNAL: {
+				/*
+				 * Only take one signal per wakeup, since any others will keep
+				 * the signalfd ready for the next one.
+				 */
+				struct signalfd_siginfo info;
+				if (read(loop->sfd, &info, sizeof(info)) != sizeof(info)) {
+					continue;
+				}
+				e->type = EVENT_SIGNAL;
+				e->ident = (int)info.ssi_signo;
+
+				/*
+				 * Translate SIGCHLD for children that have no pidfd. Several
+				 * exits can share a single SIGCHLD, so they are delivered
+				 * below, once there's room.
+				 */
+				if (e->ident == SIGCHLD) {
+					reap(loop);
+					continue;
+				}
+			} break;
+			case SOURCE_TIMER: {
+				/* The expiration count must be consumed to rearm readiness */
+				uint64_t expirations;
+				if (read(loop->tfd, &expirations, sizeof(expirations)) == -1) {
+					continue;
+				}
+				e->type = EVENT_TIMER;
+			} break;
+			case SOURCE_CHILD: {
+				/*
+				 * A pidfd stays readable forever once the child has exited, so
+				 * it has to be retired here in order to deliver it only once.
+				 */
+				size_t c = 0;
+				while (c < loop->nchildren && loop->children[c].pfd != e->ident) {
+					c++;
+				}
+				if (c == loop->nchildren) {
+					continue;
+				}
+				/* It may have been reaped with the rest after a SIGCHLD */
+				if (loop->children[c].exited) {
+					loop->exited--;
+				}
+				e->type = EVENT_EXIT;
+				e->ident = retire(loop, c);
+			} break;
+		}
+		n++;
+	}
+
+	/* Deliver as many of the exits noticed via SIGCHLD as there's room for */
+	for (size_t c = 0; c < loop->nchildren && n < count;) {
+		if (!loop->children[c].exited) {
+			c++;
+			continue;
+		}
+		struct event *e = events + n++;
+		e->type = EVENT_EXIT;
+		e->eof = true;
+		e->ident = retire(loop, c);
+		loop->exited--;
+	}
+
+	return n;
+}
+
+#endif /* __linux__ */
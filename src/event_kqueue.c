@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#if !defined(__linux__)
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+
+#include "event.h"
+#include "time.h"
+
+/* The largest number of kevents pulled out of the kernel per el_wait */
+#define KEVENT_MAX (64)
+
+/* The most signals that can be watched at once */
+#define SIGNAL_MAX (8)
+
+struct eventloop {
+	int kq;
+	/** How each watched signal was handled before it was ignored, for children */
+	int signals[SIGNAL_MAX];
+	struct sigaction original[SIGNAL_MAX];
+	size_t nsignals;
+};
+
+static void change(struct eventloop *loop, struct kevent *ev) {
+	if (kevent(loop->kq, ev, 1, NULL, 0, NULL) == -1) {
+		err(EX_OSERR, "kevent (set)");
+	}
+}
+
+struct eventloop *el_create(void) {
+	struct eventloop *loop = calloc(sizeof(struct eventloop), 1);
+	if (!loop) {
+		err(EX_OSERR, "calloc");
+	}
+
+	if ((loop->kq = kqueue()) == -1) {
+		err(EX_OSERR, "kqueue");
+	}
+
+	return loop;
+}
+
+void el_destroy(struct eventloop *loop) {
+	close(loop->kq);
+	free(loop);
+}
+
+void el_watch_fd(struct eventloop *loop, int fd) {
+	struct kevent ev;
+	EV_SET(&ev, fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
+	change(loop, &ev);
+}
+
+void el_unwatch_fd(struct eventloop *loop, int fd) {
+	struct kevent ev;
+	EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	change(loop, &ev);
+}
+
+/* Ignore a signal, keeping how it was handled before for children */
+static void ignore(struct eventloop *loop, int sig) {
+	if (loop->nsignals == SIGNAL_MAX) {
+		errx(EX_SOFTWARE, "Too many signals watched");
+	}
+	struct sigaction ignore = { .sa_handler = SIG_IGN };
+	sigemptyset(&ignore.sa_mask);
+	if (sigaction(sig, &ignore, loop->original + loop->nsignals) == -1) {
+		err(EX_OSERR, "sigaction");
+	}
+	loop->signals[loop->nsignals++] = sig;
+}
+
+void el_watch_signal(struct eventloop *loop, int sig) {
+	/*
+	 * EVFILT_SIGNAL still reports signals that are ignored, so ignore it to
+	 * make sure the default disposition never gets a chance to run.
+	 */
+	ignore(loop, sig);
+
+	struct kevent ev;
+	EV_SET(&ev, sig, EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, NULL);
+	change(loop, &ev);
+}
+
+void el_restore_signals(const struct eventloop *loop) {
+	for (size_t i = 0; i < loop->nsignals; i++) {
+		sigaction(loop->signals[i], loop->original + i, NULL);
+	}
+}
+
+void el_reap_all(struct eventloop *loop) {
+	/*
+	 * With SIGCHLD ignored, the kernel reaps every child as it exits, while
+	 * EVFILT_PROC still sees the watched ones go.
+	 */
+	ignore(loop, SIGCHLD);
+}
+
+void el_watch_child(struct eventloop *loop, pid_t pid) {
+	struct kevent ev;
+	EV_SET(&ev, pid, EVFILT_PROC, EV_ADD | EV_ENABLE, NOTE_EXIT, 0, NULL);
+	change(loop, &ev);
+}
+
+void el_timer(struct eventloop *loop, const struct timespec *after) {
+	struct kevent ev;
+	if (after) {
+		/* EVFILT_TIMER defaults to milliseconds, so round up */
+		const intptr_t ms = after->tv_sec * 1000 +
+		                    (after->tv_nsec + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+		EV_SET(&ev, 0, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, ms, NULL);
+	} else {
+		EV_SET(&ev, 0, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	}
+
+	/* Deleting a timer that was never added is harmless */
+	if (kevent(loop->kq, &ev, 1, NULL, 0, NULL) == -1 && errno != ENOENT) {
+		err(EX_OSERR, "kevent (timer)");
+	}
+}
+
+int el_wait(struct eventloop *loop, struct event *events, int count, bool block) {
+	struct kevent triggered[KEVENT_MAX];
+	if (count > KEVENT_MAX) {
+		count = KEVENT_MAX;
+	}
+
+	const struct timespec poll = {0};
+	int nev;
+	while ((nev = kevent(loop->kq, NULL, 0, triggered, count, block ? NULL : &poll)) == -1) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < nev; i++) {
+		struct event *e = events + i;
+		e->ident = (int)triggered[i].ident;
+		e->eof = triggered[i].flags & EV_EOF;
+
+		switch (triggered[i].filter) {
+			case EVFILT_READ: {
+				e->type = EVENT_READ;
+			} break;
+			case EVFILT_SIGNAL: {
+				e->type = EVENT_SIGNAL;
+			} break;
+			case EVFILT_PROC: {
+				/* Reap it, or it stays a zombie for as long as we run */
+				waitpid((pid_t)triggered[i].ident, NULL, WNOHANG);
+				e->type = EVENT_EXIT;
+			} break;
+			case EVFILT_TIMER: {
+				e->type = EVENT_TIMER;
+			} break;
+		}
+	}
+
+	return nev;
+}
+
+#endif /* !__linux__ */
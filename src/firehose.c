@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "firehose.h"
+#include "time.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+/* How long lines are counted for before the rate is reconsidered */
+#define WINDOW (250 * NSEC_PER_MSEC)
+
+/* How often the summary gets redrawn in place, and scrolled */
+#define REDRAW (100 * NSEC_PER_MSEC)
+#define SCROLL (NSEC_PER_SEC)
+
+static bool elapsed(uint64_t now, uint64_t since, uint64_t interval) {
+	return nsec_since(now, since) >= interval;
+}
+
+void fh_init(struct firehose *fh, unsigned long threshold, uint64_t slow,
+             uint64_t now) {
+	fh->threshold = threshold;
+	fh->slow = slow;
+	fh->active = false;
+	fh->window = now;
+	fh->count = 0;
+	fh->rate = 0;
+	fh->collapsed = 0;
+	fh->latest = NULL;
+	fh->latestlen = fh->latestsize = 0;
+}
+
+void fh_destroy(struct firehose *fh) {
+	free(fh->latest);
+}
+
+void fh_latest(struct firehose *fh, const char *line, size_t len) {
+	if (len > fh->latestsize) {
+		if (!(fh->latest = realloc(fh->latest, len))) {
+			err(EX_OSERR, "realloc");
+		}
+		fh->latestsize = len;
+	}
+
+	memcpy(fh->latest, line, len);
+	fh->latestlen = len;
+}
+
+bool fh_tick(struct firehose *fh, uint64_t now) {
+	if (!fh->threshold) {
+		return false;
+	}
+
+	/*
+	 * Seeing a whole window's worth of lines at the threshold rate before the
+	 * window is even over is reason enough to enter early. Otherwise a flood
+	 * gets a quarter second head start on the terminal.
+	 */
+	const unsigned long early = (unsigned long)((unsigned long long)fh->threshold *
+	                            WINDOW / NSEC_PER_SEC);
+	if (!elapsed(now, fh->window, WINDOW) &&
+	    (fh->active || fh->count < early)) {
+		return false;
+	}
+
+	uint64_t ns = nsec_since(now, fh->window);
+	if (!ns) {
+		ns = 1;
+	}
+	fh->rate = (unsigned long)(fh->count * (uint64_t)NSEC_PER_SEC / ns);
+	fh->count = 0;
+	fh->window = now;
+
+	/* Leave at a lower rate than we enter at, so the mode doesn't flap */
+	const bool active = fh->active ? fh->rate >= fh->threshold / 2
+	                               : fh->rate >= fh->threshold;
+	if (active == fh->active) {
+		return false;
+	}
+
+	/* The summary starts out fresh, but is left alone for the final one */
+	fh->active = active;
+	if (active) {
+		fh->collapsed = 0;
+		fh->drawn = fh->scrolled = now;
+	}
+	return true;
+}
+
+bool fh_redraw(const struct firehose *fh, uint64_t now) {
+	return elapsed(now, fh->drawn, REDRAW);
+}
+
+bool fh_scroll(const struct firehose *fh, uint64_t now) {
+	return elapsed(now, fh->scrolled, SCROLL);
+}
+
+uint64_t fh_due(const struct firehose *fh) {
+	return fh->drawn + REDRAW;
+}
+
+void fh_summarized(struct firehose *fh, uint64_t now, bool scrolled) {
+	fh->drawn = now;
+	if (scrolled) {
+		fh->scrolled = now;
+		fh->collapsed = 0;
+	}
+}
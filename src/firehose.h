@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Firehose mode kicks in when a child produces lines faster than anyone could
+ * read them. Timing and statistics are still kept for every line, but the
+ * display collapses into a rate-limited summary, so that tach never applies
+ * backpressure to the child just to keep a terminal busy.
+ */
+struct firehose {
+	/** Lines per second that switch firehose mode on, or 0 for never. */
+	unsigned long threshold;
+	/** Lines taking at least this long are still drawn in full. */
+	uint64_t slow;
+	bool active;
+	/** The start of the current rate measurement window. */
+	uint64_t window;
+	/** Lines completed within the current window. */
+	unsigned long count;
+	/** Lines per second, as of the last complete window. */
+	unsigned long rate;
+	/** Lines folded into the summary since it last scrolled. */
+	unsigned long collapsed;
+	/** When the summary was last drawn, and when it last scrolled. */
+	uint64_t drawn;
+	uint64_t scrolled;
+	/** A copy of the most recently completed line, for the summary. */
+	char *latest;
+	size_t latestlen;
+	size_t latestsize;
+};
+
+void fh_init(struct firehose *fh, unsigned long threshold, uint64_t slow,
+             uint64_t now);
+void fh_destroy(struct firehose *fh);
+
+static inline void fh_line(struct firehose *fh) {
+	fh->count++;
+	fh->collapsed++;
+}
+
+/* Hold onto a copy of a line, since the linebuffer will recycle it. */
+void fh_latest(struct firehose *fh, const char *line, size_t len);
+
+/*
+ * Close out the rate measurement window, if it has run its course, and enter
+ * or leave firehose mode accordingly. Returns true if the mode changed.
+ */
+bool fh_tick(struct firehose *fh, uint64_t now);
+
+/* Returns true if the summary is due to be redrawn, or scrolled. */
+bool fh_redraw(const struct firehose *fh, uint64_t now);
+bool fh_scroll(const struct firehose *fh, uint64_t now);
+
+/* When the summary is next due to be redrawn, in nanoseconds. */
+uint64_t fh_due(const struct firehose *fh);
+
+/* Note that the summary was drawn, and whether it scrolled. */
+void fh_summarized(struct firehose *fh, uint64_t now, bool scrolled);
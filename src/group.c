@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "group.h"
+#include "hash.h"
+#include "time.h"
+
+#include <err.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sysexits.h>
+
+/* The longest literal that gets searched for ahead of running a pattern */
+#define LITERAL_MAX (64)
+
+/* What lines that no pattern matched are shown as */
+#define OTHER_NAME  "(other)"
+
+struct pattern {
+	regex_t re;
+	/**
+	 * Text that every match has to contain, which is much cheaper to look
+	 * for than running the regex on lines that can't possibly match.
+	 */
+	char literal[LITERAL_MAX];
+	size_t literallen;
+	/** Where its lines go, unless a subexpression names their group */
+	struct group *group;
+};
+
+static void grow(struct groups *g) {
+	const size_t size = g->size ? g->size * 2 : 64;
+	struct group **table = calloc(size, sizeof(*table));
+	if (!table) {
+		err(EX_OSERR, "calloc");
+	}
+
+	for (size_t i = 0; i < g->size; i++) {
+		struct group *group = g->table[i];
+		if (!group) {
+			continue;
+		}
+		size_t slot = fnv(group->name, strlen(group->name)) & (size - 1);
+		while (table[slot]) {
+			slot = (slot + 1) & (size - 1);
+		}
+		table[slot] = group;
+	}
+
+	free(g->table);
+	g->table = table;
+	g->size = size;
+}
+
+/* Find the group with a name, making it if it's new */
+static struct group *lookup(struct groups *g, const char *name, size_t len) {
+	/* Keep the table under three quarters full, so probes stay short */
+	if ((g->count + 1) * 4 > g->size * 3) {
+		grow(g);
+	}
+
+	size_t slot = fnv(name, len) & (g->size - 1);
+	for (struct group *group; (group = g->table[slot]);
+	     slot = (slot + 1) & (g->size - 1)) {
+		if (!strncmp(group->name, name, len) && !group->name[len]) {
+			return group;
+		}
+	}
+
+	struct group *group = calloc(1, sizeof(struct group));
+	if (!group || !(group->name = malloc(len + 1))) {
+		err(EX_OSERR, "malloc");
+	}
+	memcpy(group->name, name, len);
+	group->name[len] = '\0';
+	g->table[slot] = group;
+	g->count++;
+	return group;
+}
+
+/*
+ * Pick out the literal text that a pattern starts with, as long as every match
+ * has to contain it. Alternation could do without it, so that gets none.
+ */
+static size_t literal(const char *pattern, char out[LITERAL_MAX]) {
+	if (strchr(pattern, '|')) {
+		return 0;
+	}
+	if (*pattern == '^') {
+		pattern++;
+	}
+
+	size_t len = 0;
+	while (len < LITERAL_MAX && pattern[len] && !strchr(".[]()*+?{}^$\\", pattern[len])) {
+		out[len] = pattern[len];
+		len++;
+	}
+
+	/* A quantifier that follows might make the last character optional */
+	if (len && strchr("*?{", pattern[len])) {
+		len--;
+	}
+	return len;
+}
+
+static bool contains(const char *text, size_t len, const char *lit, size_t litlen) {
+	const char *end = text + len;
+	while ((size_t)(end - text) >= litlen &&
+	       (text = memchr(text, *lit, (size_t)(end - text) - litlen + 1))) {
+		if (!memcmp(text, lit, litlen)) {
+			return true;
+		}
+		text++;
+	}
+	return false;
+}
+
+void group_init(struct groups *g) {
+	memset(g, 0, sizeof(*g));
+	g->other.name = OTHER_NAME;
+	grow(g);
+}
+
+void group_destroy(struct groups *g) {
+	for (size_t i = 0; i < g->npatterns; i++) {
+		regfree(&g->patterns[i].re);
+	}
+	for (size_t i = 0; i < g->size; i++) {
+		if (g->table[i]) {
+			free(g->table[i]->name);
+			free(g->table[i]);
+		}
+	}
+	free(g->patterns);
+	free(g->table);
+}
+
+bool group_add(struct groups *g, const char *pattern) {
+	struct pattern *patterns = realloc(g->patterns, (g->npatterns + 1) * sizeof(struct pattern));
+	if (!patterns) {
+		err(EX_OSERR, "realloc");
+	}
+	g->patterns = patterns;
+
+	struct pattern *p = g->patterns + g->npatterns;
+	const int error = regcomp(&p->re, pattern, REG_EXTENDED);
+	if (error) {
+		char message[128];
+		regerror(error, &p->re, message, sizeof(message));
+		warnx("Invalid pattern: %s: %s", pattern, message);
+		return false;
+	}
+
+	p->literallen = literal(pattern, p->literal);
+	p->group = lookup(g, pattern, strlen(pattern));
+	g->npatterns++;
+	return true;
+}
+
+struct group *group_match(struct groups *g, const char *text, size_t len) {
+	for (size_t i = 0; i < g->npatterns; i++) {
+		const struct pattern *p = g->patterns + i;
+		if (p->literallen && !contains(text, len, p->literal, p->literallen)) {
+			continue;
+		}
+
+		/* Lines aren't terminated, so the end has to be given explicitly */
+		regmatch_t match[2];
+		match[0].rm_so = 0;
+		match[0].rm_eo = (regoff_t)len;
+		if (regexec(&p->re, text, 2, match, REG_STARTEND)) {
+			continue;
+		}
+
+		/* A subexpression that didn't take part leaves the pattern to name it */
+		if (p->re.re_nsub && match[1].rm_so != -1) {
+			return lookup(g, text + match[1].rm_so, (size_t)(match[1].rm_eo - match[1].rm_so));
+		}
+		return p->group;
+	}
+	return NULL;
+}
+
+void group_line(struct groups *g, struct group *group, uint64_t duration) {
+	if (!group) {
+		group = &g->other;
+	}
+	group->total += duration;
+	group->lines++;
+	g->total += duration;
+	g->changed = true;
+}
+
+/* Insert a group into a list that is kept longest first, if it belongs there */
+static size_t rank(const struct group *top[], size_t n, size_t count,
+                   const struct group *group) {
+	if (!group->lines || (n == count && group->total <= top[n - 1]->total)) {
+		return n;
+	}
+
+	size_t i = n < count ? n++ : n - 1;
+	for (; i && top[i - 1]->total < group->total; i--) {
+		top[i] = top[i - 1];
+	}
+	top[i] = group;
+	return n;
+}
+
+size_t group_top(const struct groups *g, const struct group *top[], size_t count) {
+	size_t n = 0;
+	if (!count) {
+		return 0;
+	}
+	for (size_t i = 0; i < g->size; i++) {
+		if (g->table[i]) {
+			n = rank(top, n, count, g->table[i]);
+		}
+	}
+	return n;
+}
+
+static int longest(const void *a, const void *b) {
+	const struct group *x = *(const struct group * const *)a;
+	const struct group *y = *(const struct group * const *)b;
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+void group_print(const struct groups *g, FILE *out) {
+	const struct group **all = malloc((g->count + 1) * sizeof(*all));
+	if (!all) {
+		err(EX_OSERR, "malloc");
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < g->size; i++) {
+		if (g->table[i] && g->table[i]->lines) {
+			all[n++] = g->table[i];
+		}
+	}
+	if (g->other.lines) {
+		all[n++] = &g->other;
+	}
+	qsort(all, n, sizeof(*all), longest);
+
+	for (size_t i = 0; i < n; i++) {
+		const struct timespec total = timespec_from_nsec(all[i]->total);
+		const double percent = g->total ? 100.0 * all[i]->total / g->total : 0.0;
+		fprintf(out, "%6lu.%06lu %5.1f%% %8lu lines  %s\n",
+		        total.tv_sec, total.tv_nsec / NSEC_PER_USEC, percent,
+		        all[i]->lines, all[i]->name);
+	}
+	free(all);
+}
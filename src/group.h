@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Groups add up the time spent on lines by what they were about, going by
+ * patterns given on the command line. A line belongs to the first pattern that
+ * matches it, and a pattern with a subexpression puts each line in a group
+ * named after whatever the subexpression matched, such as a build target.
+ */
+struct group {
+	char *name;
+	/** The sum of its lines' durations, and how many there were */
+	uint64_t total;
+	unsigned long lines;
+};
+
+struct pattern;
+
+struct groups {
+	struct pattern *patterns;
+	size_t npatterns;
+	/** Every group seen so far, hashed by name */
+	struct group **table;
+	size_t size;
+	size_t count;
+	/** Lines that no pattern matched */
+	struct group other;
+	/** The sum of every line's duration, grouped or not */
+	uint64_t total;
+	/** Whether any group has changed since this was last cleared */
+	bool changed;
+};
+
+void group_init(struct groups *g);
+void group_destroy(struct groups *g);
+
+/* Compile a pattern, once and for all. Returns false if it isn't valid. */
+bool group_add(struct groups *g, const char *pattern);
+
+/* The group that a line's text belongs to, or NULL if no pattern matches */
+struct group *group_match(struct groups *g, const char *text, size_t len);
+
+/* Account for a finished line, in its group or, given NULL, in no group */
+void group_line(struct groups *g, struct group *group, uint64_t duration);
+
+/*
+ * Find up to count groups that took the longest, longest first. Returns how
+ * many there were.
+ */
+size_t group_top(const struct groups *g, const struct group *top[], size_t count);
+
+/* Break the total down by group, longest first */
+void group_print(const struct groups *g, FILE *out);
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FNV-1a, for the hash tables that are keyed by text. It's quick on short
+ * strings, and can be built up a byte at a time from FNV_OFFSET by text that
+ * gets normalized along the way, rather than copied first.
+ */
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME  (0x100000001b3ULL)
+
+static inline uint64_t fnv_mix(uint64_t h, unsigned char c) {
+	return (h ^ c) * FNV_PRIME;
+}
+
+static inline uint64_t fnv(const char *text, size_t len) {
+	uint64_t h = FNV_OFFSET;
+	for (size_t i = 0; i < len; i++) {
+		h = fnv_mix(h, (unsigned char)text[i]);
+	}
+	return h;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "histogram.h"
+#include "time.h"
+
+#include <string.h>
+
+/* The width of the longest bar that hist_print will draw */
+#define BAR_WIDTH (40)
+
+/* The smallest and largest values that land in a bucket */
+static uint64_t lower(unsigned bucket) {
+	if (bucket < HIST_SUB) {
+		return bucket;
+	}
+
+	const unsigned shift = bucket / HIST_SUB - 1;
+	return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+}
+
+static uint64_t upper(unsigned bucket) {
+	if (bucket < HIST_SUB) {
+		return bucket;
+	}
+
+	const unsigned shift = bucket / HIST_SUB - 1;
+	return lower(bucket) + ((uint64_t)1 << shift) - 1;
+}
+
+void hist_init(struct histogram *h) {
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+uint64_t hist_percentile(const struct histogram *h, double percent) {
+	if (!h->count) {
+		return 0;
+	}
+
+	/* The rank of the value we're after, counting from 1 */
+	uint64_t rank = (uint64_t)(percent / 100.0 * (double)h->count + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank) {
+			const uint64_t top = upper(i);
+			return top < h->max ? top : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+void hist_print_percentiles(const struct histogram *h, FILE *out) {
+	static const struct {
+		const char *label;
+		double percent;
+	} percentiles[] = {
+		{ "p50:", 50.0 },
+		{ "p90:", 90.0 },
+		{ "p99:", 99.0 },
+		{ "p99.9:", 99.9 },
+	};
+
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+		const struct timespec ts = timespec_from_nsec(hist_percentile(h, percentiles[i].percent));
+		fprintf(out, "%-7s%6lu.%06lu\n", percentiles[i].label, ts.tv_sec,
+		        ts.tv_nsec / NSEC_PER_USEC);
+	}
+}
+
+void hist_print(const struct histogram *h, FILE *out) {
+	static const struct {
+		const char *label;
+		uint64_t below;
+	} decades[] = {
+		{ "<1ms", NSEC_PER_MSEC },
+		{ "1-10ms", 10 * NSEC_PER_MSEC },
+		{ "10-100ms", 100 * NSEC_PER_MSEC },
+		{ "0.1-1s", NSEC_PER_SEC },
+		{ "1-10s", 10ULL * NSEC_PER_SEC },
+		{ ">=10s", UINT64_MAX },
+	};
+	const size_t ndecades = sizeof(decades) / sizeof(*decades);
+
+	/* Bucket boundaries don't line up with decades, so go by lower bounds */
+	uint64_t counts[sizeof(decades) / sizeof(*decades)] = {0};
+	size_t d = 0;
+	for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+		while (lower(i) >= decades[d].below) {
+			d++;
+		}
+		counts[d] += h->counts[i];
+	}
+
+	uint64_t most = 0;
+	for (d = 0; d < ndecades; d++) {
+		if (counts[d] > most) {
+			most = counts[d];
+		}
+	}
+
+	for (d = 0; d < ndecades; d++) {
+		const int bar = most ? (int)((counts[d] * BAR_WIDTH + most - 1) / most) : 0;
+		fprintf(out, "%9s %-*.*s %llu\n", decades[d].label, BAR_WIDTH, bar,
+		        "########################################",
+		        (unsigned long long)counts[d]);
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A log-bucketed latency histogram, in the spirit of HdrHistogram. Each power
+ * of two is split into HIST_SUB linear sub-buckets, so every value is kept to
+ * within about 3% no matter its magnitude, in a fixed amount of memory.
+ */
+#define HIST_SUB_BITS (5)
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+	uint64_t counts[HIST_BUCKETS];
+	/** The number of values added */
+	uint64_t count;
+	/** The sum of the values added */
+	uint64_t total;
+	/** The exact extremes of the values added */
+	uint64_t min;
+	uint64_t max;
+};
+
+void hist_init(struct histogram *h);
+
+static inline unsigned hist_bucket(uint64_t value) {
+	if (value < HIST_SUB) {
+		return (unsigned)value;
+	}
+
+	const unsigned msb = 63 - (unsigned)__builtin_clzll(value);
+	const unsigned shift = msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (unsigned)((value >> shift) & (HIST_SUB - 1));
+}
+
+static inline void hist_add(struct histogram *h, uint64_t value) {
+	h->counts[hist_bucket(value)]++;
+	h->count++;
+	h->total += value;
+	if (value < h->min) {
+		h->min = value;
+	}
+	if (value > h->max) {
+		h->max = value;
+	}
+}
+
+/*
+ * The value below which the given percentage of values fall. The result is
+ * the top of the bucket that it lands in, but never more than the maximum.
+ */
+uint64_t hist_percentile(const struct histogram *h, double percent);
+
+/* Print the usual percentiles, one per line, in the style of the summary. */
+void hist_print_percentiles(const struct histogram *h, FILE *out);
+
+/* Print a compact bar chart of how the values are distributed, by decade. */
+void hist_print(const struct histogram *h, FILE *out);
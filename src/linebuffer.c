@@ -23,16 +23,192 @@
 #include "linebuffer.h"
 
 #include <assert.h>
+#include <err.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sysexits.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The smallest backing storage allocated, which bounds the size of a single
+ * read. It is always kept at least a few lines wide, so that the unfinished
+ * tail of the previous read is only ever a small fraction of it.
+ */
+#define LB_MINSIZE (64 * 1024)
+
+/*
+ * The most bytes a line can run to before it's wrapped regardless, which only
+ * happens when it's nearly all escape sequences. It keeps the unfinished line
+ * from ever filling the storage.
+ */
+#define LB_MAXLINE(line) ((line)->size / 4)
+
+#define ESC   (0x1b)
+#define BEL   (0x07)
+#define TAB   (0x09)
+#define DEL   (0x7f)
+
+/* Tab stops are every 8 columns, as far as the line itself is concerned */
+#define TAB_WIDTH (8)
+
+/* Code points that don't take up a column of their own, or take up two */
+static const struct range {
+	unsigned long first;
+	unsigned long last;
+} zero[] = {
+	{ 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+	{ 0x0610, 0x061a }, { 0x064b, 0x065f }, { 0x0e31, 0x0e3a },
+	{ 0x1ab0, 0x1aff }, { 0x1dc0, 0x1dff }, { 0x200b, 0x200f },
+	{ 0x20d0, 0x20ff }, { 0xfe00, 0xfe0f }, { 0xfe20, 0xfe2f },
+	{ 0xfeff, 0xfeff }, { 0xe0100, 0xe01ef },
+}, wide[] = {
+	{ 0x1100, 0x115f }, { 0x231a, 0x231b }, { 0x2329, 0x232a },
+	{ 0x23e9, 0x23ec }, { 0x25fd, 0x25fe }, { 0x2614, 0x2615 },
+	{ 0x2e80, 0x303e }, { 0x3041, 0x33ff }, { 0x3400, 0x4dbf },
+	{ 0x4e00, 0x9fff }, { 0xa000, 0xa4cf }, { 0xac00, 0xd7a3 },
+	{ 0xf900, 0xfaff }, { 0xfe30, 0xfe4f }, { 0xff00, 0xff60 },
+	{ 0xffe0, 0xffe6 }, { 0x1f300, 0x1f64f }, { 0x1f900, 0x1f9ff },
+	{ 0x20000, 0x2fffd }, { 0x30000, 0x3fffd },
+};
+
+static bool _lb_within(const struct range *r, size_t n, unsigned long cp) {
+	for (size_t i = 0; i < n; i++) {
+		if (cp >= r[i].first && cp <= r[i].last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int _lb_width(unsigned long cp) {
+	if (_lb_within(zero, sizeof(zero) / sizeof(*zero), cp)) {
+		return 0;
+	}
+	if (_lb_within(wide, sizeof(wide) / sizeof(*wide), cp)) {
+		return 2;
+	}
+	return 1;
+}
+
+/*
+ * Count the printable ASCII at the start of some bytes, which is all that
+ * most lines are made of, so it's worth doing 16 bytes at a time.
+ */
+static size_t _lb_ascii(const char *data, size_t len) {
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i del = _mm_set1_epi8(DEL);
+	for (; i + 16 <= len; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+
+		/* The comparison is signed, so anything above ASCII is below space */
+		const int special = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space),
+		                                                   _mm_cmpeq_epi8(v, del)));
+		if (special) {
+			return i + (size_t)__builtin_ctz((unsigned)special);
+		}
+	}
+#endif
+	while (i < len && (unsigned char)data[i] >= ' ' && (unsigned char)data[i] < DEL) {
+		i++;
+	}
+	return i;
+}
+
+/*
+ * Feed a single byte, that isn't a line ending, to the parser. Returns the
+ * number of columns taken up by the character it finishes, which started at
+ * line->mark, or -1 if it doesn't finish one. If the byte turns out not to
+ * belong to the character before it, it has to be fed in again.
+ */
+static int _lb_step(struct linebuffer *line, unsigned char c, bool *again) {
+	switch (line->state) {
+		case LB_GROUND: {
+			if (c == ESC) {
+				line->state = LB_ESC;
+			} else if (c == TAB) {
+				line->moved = true;
+				return (int)(TAB_WIDTH - line->col % TAB_WIDTH);
+			} else if (c < ' ' || c == DEL) {
+				/* Other control characters don't move the cursor forward */
+				line->moved |= c != BEL && c != DEL;
+			} else if (c < 0x80) {
+				return 1;
+			} else if (c >= 0xc2 && c <= 0xf4) {
+				line->need = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+				line->cp = c & (0x3f >> line->need);
+				line->state = LB_UTF8;
+			} else {
+				/* Not valid UTF-8, which a terminal shows as a placeholder */
+				line->moved = true;
+				return 1;
+			}
+		} break;
+		case LB_UTF8: {
+			line->state = LB_GROUND;
+			if ((c & 0xc0) != 0x80) {
+				/* The character was cut short, so it's just a placeholder */
+				line->moved = true;
+				*again = true;
+				return 1;
+			}
+			line->cp = (line->cp << 6) | (c & 0x3f);
+			if (--line->need) {
+				line->state = LB_UTF8;
+				break;
+			}
+			const int width = _lb_width(line->cp);
+			line->moved |= width != 1;
+			return width;
+		}
+		case LB_ESC: {
+			if (c == '[') {
+				line->state = LB_CSI;
+			} else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+				line->state = LB_STRING;
+			} else if (c < ' ' || c > '/') {
+				/* Anything but an intermediate byte finishes the sequence */
+				line->state = LB_GROUND;
+				line->moved = true;
+			}
+		} break;
+		case LB_CSI: {
+			/* Parameters and intermediates go on until the final byte */
+			if (c >= '@' && c <= '~') {
+				line->state = LB_GROUND;
+
+				/* Colors are harmless, but anything else could move the cursor */
+				line->moved |= c != 'm';
+			}
+		} break;
+		case LB_STRING: {
+			if (c == BEL) {
+				line->state = LB_GROUND;
+			} else if (c == ESC) {
+				line->state = LB_STRING_ESC;
+			}
+		} break;
+		case LB_STRING_ESC: {
+			/* ESC \ is the string terminator, and anything else is more string */
+			line->state = c == '\\' ? LB_GROUND : c == ESC ? LB_STRING_ESC : LB_STRING;
+		} break;
+	}
+	return -1;
+}
+
 static void _lb_sanitycheck(struct linebuffer *lb) {
 	/* Ensure buffer has been allocated */
 	assert(lb->buf);
 
-	/* Ensure buf is NULL terminated */
-	assert(lb->buf[lb->cur] == '\0');
+	/* Ensure the offsets are in order */
+	assert(lb->line <= lb->scan);
+	assert(lb->scan <= lb->end);
+	assert(lb->end <= lb->size);
 }
 
 struct linebuffer *lb_create(void) {
@@ -42,110 +218,162 @@ struct linebuffer *lb_create(void) {
 void lb_destroy(struct linebuffer *line) {
 	_lb_sanitycheck(line);
 
-	if (line->buf) {
-		free(line->buf);
-	}
-	if (line->tmp) {
-		free(line->tmp);
-	}
+	free(line->buf);
 	free(line);
 }
 
 void lb_resize(struct linebuffer *line, size_t size) {
-	line->buf = realloc(line->buf, size + 1);
-	line->len = size;
+	size_t storage = size * 4;
+	if (storage < LB_MINSIZE) {
+		storage = LB_MINSIZE;
+	}
 
-	lb_reset(line);
+	/* Only ever grow the storage, since it may hold an unfinished line */
+	if (storage > line->size) {
+		if (!(line->buf = realloc(line->buf, storage))) {
+			err(EX_OSERR, "realloc");
+		}
+		line->size = storage;
+	}
+	line->len = size;
 }
 
-void lb_reset(struct linebuffer *line) {
-	memset(line->buf, 0, line->len + 1);
-	line->cur = 0;
+/*
+ * Recycle the storage. With no unfinished line this is free, otherwise it
+ * costs no more than a single line width of copying, and only happens once
+ * the tail end of the storage gets tight.
+ */
+static void _lb_compact(struct linebuffer *line) {
+	if (line->line == line->end) {
+		line->line = line->scan = line->end = 0;
+	} else if (line->size - line->end < line->size / 2) {
+		const size_t pending = line->end - line->line;
+		memmove(line->buf, line->buf + line->line, pending);
+		line->scan -= line->line;
+		line->mark = line->mark > line->line ? line->mark - line->line : 0;
+		line->line = 0;
+		line->end = pending;
+	}
 }
 
-bool lb_read(struct linebuffer *line, int fd, bool *newline) {
+ssize_t lb_fill(struct linebuffer *line, int fd) {
 	_lb_sanitycheck(line);
+	_lb_compact(line);
 
-	/*
-	 * If the previous line was terminated by a carriage return, reposition at
-	 * the beginning of the linebuffer.
-	 */
-	if(line->cr) {
-		line->cur = 0;
-		line->buf[0] = '\0';
-		line->cr = false;
+	const ssize_t cur = read(fd, line->buf + line->end, line->size - line->end);
+	if (cur > 0) {
+		line->end += (size_t)cur;
 	}
 
-	char *now = line->buf + line->cur;
-	*newline = false;
+	return cur;
+}
 
-	/*
-	 * If there is a tmp string buffered up from a previous read, use that,
-	 * otherwise actually read from the file descriptor.
-	 */
-	ssize_t cur;
-	if (line->tmp) {
-		cur = (ssize_t)strlen(line->tmp);
-		strncpy(now, line->tmp, cur);
-		free(line->tmp);
-		line->tmp = NULL;
-	} else {
-		cur = read(fd, now, line->len - line->cur);
-
-		/* Bubble read errors up to the caller */
-		if (cur <= 0) {
-			return false;
+size_t lb_append(struct linebuffer *line, const char *data, size_t len) {
+	_lb_sanitycheck(line);
+	_lb_compact(line);
+
+	const size_t room = line->size - line->end;
+	const size_t cur = len < room ? len : room;
+	memcpy(line->buf + line->end, data, cur);
+	line->end += cur;
+
+	return cur;
+}
+
+/* Finish the current line at an offset, with the parser starting over after it */
+static void _lb_finish(struct linebuffer *line, struct lb_span *span,
+                       size_t at, size_t next, enum lb_end end) {
+	span->len = at - line->line;
+	span->end = end;
+	line->line = line->scan = next;
+	line->col = 0;
+	line->state = LB_GROUND;
+	line->moved = false;
+}
+
+bool lb_next(struct linebuffer *line, struct lb_span *span) {
+	_lb_sanitycheck(line);
+
+	span->off = line->line;
+	while (line->scan < line->end) {
+		/* Take as much printable ASCII as still fits, all at once */
+		if (line->state == LB_GROUND && line->col < line->len) {
+			const size_t room = line->len - line->col;
+			const size_t left = line->end - line->scan;
+			const size_t run = _lb_ascii(line->buf + line->scan, left < room ? left : room);
+			line->scan += run;
+			line->col += run;
+			if (line->scan == line->end) {
+				break;
+			}
 		}
-	}
 
-	/*
-	 * NULL terminate the buffer, regardless of where it came from.
-	 * Technically, this makes the line buffer diverge from the screen contents
-	 * whenever there is a carriage return followed by a shorter line. However,
-	 * due to the fact that we will only end up printing up to the NULL
-	 * terminator, the results will be visually identical.
-	 */
-	now[cur] = '\0';
+		const size_t at = line->scan;
+		const char c = line->buf[at];
 
-	/*
-	 * Don't allow reading of more than a single "line" per call. If we read
-	 * too much, split the line in two, and put the remainder in a buffer for
-	 * the next caller to get.
-	 */
-	char *nl = strpbrk(now, "\n\r");
-	if (nl) {
-		switch (*nl) {
-			case '\n': {
-				*newline = true;
-			} break;
-			case '\r': {
-				line->cr = true;
-			} break;
+		if (c == '\n') {
+			_lb_finish(line, span, at, at + 1, LB_NEWLINE);
+			return true;
 		}
 
-		/*
-		 * If there is a newline and it's at the tail end, chop it off.
-		 * If it's not the tail end, then split the buffer, hold onto the
-		 * latter half, and return the first half.
-		 */
-		*nl = '\0';
-
-		if (nl - now != cur - 1) {
-			line->tmp = strdup(nl+1);
-			cur = nl - now;
-		} else {
-			cur--;
+		if (c == '\r') {
+			/*
+			 * A carriage return followed by a newline is just a CRLF, which is
+			 * how every line comes out of a pty. If the carriage return is the
+			 * last thing read so far, wait to see what comes after it.
+			 */
+			if (at + 1 == line->end) {
+				return false;
+			}
+			if (line->buf[at + 1] == '\n') {
+				_lb_finish(line, span, at, at + 2, LB_NEWLINE);
+			} else {
+				_lb_finish(line, span, at, at + 1, LB_RETURN);
+			}
+			return true;
 		}
-	}
 
-	line->cur += (size_t)cur;
+		/* A line that's nearly all escape sequences still has to end somewhere */
+		if (at - line->line >= LB_MAXLINE(line)) {
+			const size_t cut = line->state != LB_GROUND && line->mark > line->line ? line->mark : at;
+			_lb_finish(line, span, cut, cut, LB_WRAP);
+			return true;
+		}
 
-	_lb_sanitycheck(line);
-	return true;
-}
+		if (line->state == LB_GROUND) {
+			line->mark = at;
+		}
 
-bool lb_full(struct linebuffer *line) {
-	_lb_sanitycheck(line);
+		bool again = false;
+		const int width = _lb_step(line, (unsigned char)c, &again);
 
-	return line->cur == line->len;
+		/* Wrap right before a character that doesn't fit, unless nothing would */
+		if (width > 0 && line->col && line->col + (size_t)width > line->len) {
+			_lb_finish(line, span, line->mark, line->mark, LB_WRAP);
+			return true;
+		}
+
+		if (width > 0) {
+			line->col += (size_t)width;
+		}
+		if (!again) {
+			line->scan++;
+		}
+	}
+
+	return false;
+}
+
+struct lb_span lb_partial(const struct linebuffer *line) {
+	/*
+	 * Leave off a carriage return that lb_next is still holding onto, as well
+	 * as any sequence or character that hasn't finished arriving yet.
+	 */
+	const size_t end = line->state == LB_GROUND ? line->scan : line->mark;
+	struct lb_span span = {
+		.off = line->line,
+		.len = end - line->line,
+		.end = LB_PARTIAL,
+	};
+	return span;
 }
@@ -22,31 +22,169 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* How a span of the linebuffer came to an end */
+enum lb_end {
+	/** The line is still going, and more input is needed to finish it. */
+	LB_PARTIAL,
+	/** The line was terminated by a newline. */
+	LB_NEWLINE,
+	/** The line was terminated by a carriage return. */
+	LB_RETURN,
+	/** The line filled the width of the linebuffer and has to wrap. */
+	LB_WRAP,
+};
+
+/*
+ * A view of a single line inside of the linebuffer. Spans are only valid
+ * until the next call to lb_fill or lb_append, and are not NULL terminated.
+ */
+struct lb_span {
+	/** The offset of the first byte of the line within buf. */
+	size_t off;
+	/** The number of bytes in the line, excluding any terminator. */
+	size_t len;
+	enum lb_end end;
+};
+
+/* Where the parser is, inside the bytes of a line */
+enum lb_state {
+	/** Between characters */
+	LB_GROUND,
+	/** Inside of a UTF-8 character, waiting on its continuation bytes */
+	LB_UTF8,
+	/** After an ESC, or an ESC and intermediate bytes */
+	LB_ESC,
+	/** Inside of a control sequence, such as a color change */
+	LB_CSI,
+	/** Inside of a string sequence, such as a title change */
+	LB_STRING,
+	/** After an ESC inside of a string sequence, which may end it */
+	LB_STRING_ESC,
+};
 
 struct linebuffer {
-	/** The actual string, guaranteed to be NULL terminated. */
+	/** The fixed-size backing storage that reads land in. */
 	char *buf;
-	/** The buffer size. */
+	/** The size of buf. */
+	size_t size;
+	/** The line width in columns, past which lines wrap. */
 	size_t len;
-	/** The current string length. */
-	size_t cur;
-	/** A temporary holding buffer for reads that span a newline, also NULL terminated */
-	char *tmp;
-	/** This flag indicates if the preceding line was terminated by a carriage
-	 *  return. If this flag is set, the next lb_read will overwrite the
-	 *  existing buffer contents. */
-	bool cr;
+	/** The offset of the first byte of the current, unfinished line. */
+	size_t line;
+	/** The offset of the first byte not yet searched for a line ending. */
+	size_t scan;
+	/** The offset of the end of the data that has been read. */
+	size_t end;
+
+	/** The columns taken up by the searched part of the current line. */
+	size_t col;
+	/** The parser state as of scan, an enum lb_state. */
+	int state;
+	/** The offset of the sequence or character the parser is inside of. */
+	size_t mark;
+	/** The UTF-8 character being decoded, and how many bytes it still needs. */
+	unsigned long cp;
+	int need;
+	/**
+	 * Whether the current line has anything in it that a terminal might not
+	 * agree on the width of, such as tabs, cursor movement, or characters
+	 * that aren't a single column wide.
+	 */
+	bool moved;
 };
 
 struct linebuffer *lb_create(void);
 void lb_destroy(struct linebuffer *line);
 void lb_resize(struct linebuffer *line, size_t size);
-void lb_reset(struct linebuffer *line);
-bool lb_full(struct linebuffer *line);
 
 /*
- * Like getline(3), but rather than including the newline it simply returns a
- * boolean, via an out pointer, that indicates the presence of the newline.
- * The return value indicates whether or not read(2) was successful.
+ * Perform a single read(2), as large as the linebuffer has room for.
+ * The return value is that of read(2). All of the lines that were completed
+ * by the previous read should be collected with lb_next before calling this
+ * again, since the space they occupy is recycled.
+ */
+ssize_t lb_fill(struct linebuffer *line, int fd);
+
+/*
+ * Like lb_fill, but for data that has already been read. Returns how much of
+ * it fit, which is only ever short when the lines collected so far leave too
+ * little room, so the rest should be appended once they have been handled.
+ */
+size_t lb_append(struct linebuffer *line, const char *data, size_t len);
+
+/*
+ * Split the next complete line out of the data that has been read, without
+ * copying it. Returns false once there are no complete lines left, at which
+ * point lb_partial describes whatever is left over.
+ *
+ * Lines wrap once they fill the line width in display columns, so escape
+ * sequences take up no room, and UTF-8 characters take up as many columns as
+ * a terminal would give them. Neither is ever split in two, by a wrap or by
+ * the end of a partial line.
+ */
+bool lb_next(struct linebuffer *line, struct lb_span *span);
+struct lb_span lb_partial(const struct linebuffer *line);
+
+static inline const char *lb_data(const struct linebuffer *line,
+                                  const struct lb_span *span) {
+	return line->buf + span->off;
+}
+
+/*
+ * Skip past the escape sequence that starts with the ESC at text[i], as the
+ * linebuffer reads them: a CSI runs to its final byte, a string such as an OSC
+ * or DCS runs to its terminator, which is ST or BEL, and anything else runs
+ * past any intermediate bytes to its final one. Returns where the text after
+ * it starts, which is len for a sequence that is cut short.
  */
-bool lb_read(struct linebuffer *line, int fd, bool *newline);
+static inline size_t lb_escape(const char *text, size_t len, size_t i) {
+	const unsigned char *c = (const unsigned char *)text;
+	if (++i == len) {
+		return i;
+	}
+
+	const unsigned char kind = c[i++];
+	if (kind == '[') {
+		while (i < len && (c[i] < '@' || c[i] > '~')) {
+			i++;
+		}
+		return i < len ? i + 1 : i;
+	}
+	if (kind == ']' || kind == 'P' || kind == 'X' || kind == '^' || kind == '_') {
+		while (i < len && c[i] != '\a' &&
+		       !(c[i] == 0x1b && i + 1 < len && c[i + 1] == '\\')) {
+			i++;
+		}
+		return i == len ? i : c[i] == '\a' ? i + 1 : i + 2;
+	}
+	for (unsigned char k = kind; k >= ' ' && k <= '/' && i < len;) {
+		k = c[i++];
+	}
+	return i;
+}
+
+/* The most of a line's text that is kept after its spans are recycled */
+#define LB_TEXT (256)
+
+/*
+ * The start of a line's text, gathered up from each of its spans as it wraps,
+ * for whatever needs to see it once it's done.
+ */
+struct lb_text {
+	char text[LB_TEXT];
+	size_t len;
+};
+
+static inline void lb_text_append(struct lb_text *lt, const char *text, size_t len) {
+	const size_t room = LB_TEXT - lt->len;
+	const size_t n = len < room ? len : room;
+	memcpy(lt->text + lt->len, text, n);
+	lt->len += n;
+}
+
+static inline void lb_text_clear(struct lb_text *lt) {
+	lt->len = 0;
+}
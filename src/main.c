@@ -20,78 +20,1166 @@
  * IN THE SOFTWARE.
  */
 
-#include <assert.h>
 #include <err.h>
+#include <getopt.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
-#include <sys/event.h>
 #include <sys/ioctl.h>
 #include <sysexits.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "baseline.h"
+#include "capture.h"
+#include "event.h"
+#include "firehose.h"
+#include "group.h"
+#include "histogram.h"
 #include "linebuffer.h"
-#include "time.h"
+#include "metrics.h"
 #include "pipe.h"
-
-/*
- * 8 digits on the left-hand-side will allow for a process
- * spanning ~3.17 years of runtime to not have problems
- * with running out of timestamp columns.
- */
-#define TS_FMT        "%8ld.%03ld"
-#define TS_WIDTH      (8 + 1 + 3) /* sec + '.' + nsec */
-#define TS_ARG(ts)    ts.tv_sec, (ts.tv_nsec / NSEC_PER_MSEC)
+#include "procs.h"
+#include "record.h"
+#include "render.h"
+#include "report.h"
+#include "resources.h"
+#include "time.h"
+#include "topn.h"
+#include "trace.h"
 
 #define SEP_WIDTH     (3) /* " | " */
 #define SEP_FMT       COLOR_RESET " " COLOR_SEP " " COLOR_RESET " "
 #define SEP_FMT_ERR   COLOR_RESET " " COLOR_ERR " " COLOR_RESET " "
+#define SEP_FMT_SLOWER COLOR_RESET " " COLOR_SLOWER " " COLOR_RESET " "
+#define SEP_FMT_FASTER COLOR_RESET " " COLOR_FASTER " " COLOR_RESET " "
 
 #define COLOR_RESET   "\x1b[0m"
 #define COLOR_SEP     "\x1b[30;47m"
 #define COLOR_ERR     "\x1b[30;101m"
 #define COLOR_FAST    "\x1b[90m"
+#define COLOR_SLOWER  "\x1b[30;103m"
+#define COLOR_FASTER  "\x1b[30;102m"
+#define CLEAR_EOL     "\x1b[K"
+
+/* Down a line, clear everything from there on, and back up again */
+#define CLEAR_BELOW   "\x1b[B\x1b[J\x1b[A"
+
+/* Fewer columns than this are cheaper to draw again than to skip over */
+#define CUF_MIN       (4)
 
-#define EVENT_COUNT   (5)
+/* Defaults for when firehose mode kicks in, and what it still shows */
+#define FIREHOSE_RATE (10000) /* lines/sec */
+#define FIREHOSE_SLOW (250) /* msec */
 
-/* Timer display refresh rate */
-static const struct timespec timeout = {
-	.tv_nsec = 17 * NSEC_PER_MSEC, /* ~60 Hz */
+/* How many groups the live table shows, and how often it's redrawn */
+#define GROUP_ROWS    (5)
+#define GROUP_REDRAW  (100 * NSEC_PER_MSEC)
+
+/* The width of the column for the CPU use of each line, such as " 87% " */
+#define USAGE_WIDTH   (6)
+
+/* The width of the column for the commands that ran during each line, such as "cc1,as " */
+#define PROCS_WIDTH   (16)
+
+/* How many of the slowest lines are listed at exit, unless -n says otherwise */
+#define SLOWEST       (10)
+
+/* How many of the biggest regressions from a baseline are listed at exit */
+#define REGRESSIONS   (10)
+
+/*
+ * How far a line has to move from its baseline to count as slower or faster,
+ * as a fraction of the baseline, and at the very least
+ */
+#define BASELINE_SHARE (4) /* a quarter */
+#define BASELINE_MIN   (NSEC_PER_MSEC)
+
+/* The most events handled per wakeup */
+#define EVENT_COUNT   (16)
+
+/*
+ * How often the timestamp of an idle line gets redrawn. Young lines tick over
+ * at about the refresh rate of a display, and older ones only as often as a
+ * coarser digit changes, since nobody is reading their milliseconds anymore.
+ */
+static const struct {
+	uint64_t age;
+	uint64_t step;
+} backoff[] = {
+	{ 1 * NSEC_PER_SEC, 17 * NSEC_PER_MSEC }, /* ~60 Hz */
+	{ 10 * NSEC_PER_SEC, 100 * NSEC_PER_MSEC },
+	{ UINT64_MAX, 1 * NSEC_PER_SEC },
+};
+
+/* How long a dead child gets for any last output, if its pipes are held open */
+#define REAP_DELAY    (17 * NSEC_PER_MSEC)
+
+/* A command of "-" reads stdin, or whatever fd or file follows it, instead */
+#define STREAM_JOB    "-"
+#define STREAM_STDIN  "0"
+
+/* Line duration distributions, overall and for each stream */
+struct latency {
+	struct histogram all;
+	struct histogram out;
+	struct histogram err;
 };
 
-static void winch(struct linebuffer *lb) {
+/* One of a job's output streams, which is split into lines of its own */
+struct stream {
+	struct linebuffer *lb;
+	/** When the line it's in the middle of started */
+	uint64_t last;
+	/** How its lines are drawn, and recorded */
+	const char *sep;
+	enum rec_stream id;
+	/** The group the line it's in the middle of belongs to, once known */
+	struct group *group;
+	/** Whether that line has wrapped, so its later rows aren't matched */
+	bool wrapped;
+	/** What's been seen of that line, for the trace and the slowest lines */
+	struct lb_text text;
+};
+
+/* A single command, along with its own view of its output */
+struct job {
+	char **argv;
+	struct descendent child;
+	enum {
+		JOB_PENDING,
+		JOB_RUNNING,
+		JOB_DONE,
+	} state;
+
+	/** Drawn before each of its lines when there are several jobs */
+	char tag[32];
+	size_t taglen;
+
+	/** Each gets its own lines, so one can't split the other's in two */
+	struct stream out;
+	struct stream err;
+	/** Only allocated when there are several jobs, to summarize each */
+	struct histogram *lat;
+	/** Only allocated when resource usage is being followed */
+	struct resources *res;
+
+	/** When the job was started and finished */
+	uint64_t start;
+	uint64_t end;
+	int numlines;
+
+	/** Its streams that haven't reached EOF yet */
+	int open;
+	/** Whether it has exited, before and after the current batch */
+	bool dead;
+	bool wasdead;
+	/** Whether it said anything in the current batch */
+	bool activity;
+};
+
+/* What tach itself has been up to, as opposed to the jobs it runs */
+struct counters {
+	/** Times the eventloop woke up, and idle timestamps drawn */
+	uint64_t wakeups;
+	uint64_t redraws;
+	/** Time spent handling wakeups, and waiting for them */
+	uint64_t busy;
+	uint64_t waiting;
+	/** The longest from a read returning to its output being written out */
+	uint64_t latency;
+	/** When the oldest read that hasn't been written out returned, or 0 */
+	uint64_t pending;
+};
+
+/*
+ * What's on the bottom line of the terminal, which is all that ever gets
+ * redrawn, so that a redraw only has to send what changed.
+ */
+struct screen {
+	/** The stream whose unfinished line is there, if any */
+	const struct stream *st;
+	/** How much of that line is shown, in bytes and in columns */
+	size_t bytes;
+	size_t cols;
+	/** The timestamp at the start of the line, if it's known */
+	char ts[TS_MAX];
+	size_t tslen;
+};
+
+/* Everything that the jobs' output gets drawn into and accounted against */
+struct session {
+	struct job *jobs;
+	size_t njobs;
+	/** The most jobs to run at once, and how many are */
+	size_t parallel;
+	size_t running;
+
+	struct renderbuf *rb;
+	struct firehose fh;
+	struct recorder *rec;
+	struct tracer *tracer;
+	struct metrics *metrics;
+	struct latency *lat;
+	/** Only allocated when lines are being grouped */
+	struct groups *groups;
+	/** Whether each job's resource usage is being followed */
+	bool resources;
+	/** Only opened when following every process the jobs start */
+	struct procs *procs;
+	struct topn slowest;
+
+	/** Only opened when comparing with an earlier run */
+	struct baseline *baseline;
+	struct topn regressions;
+	int matched;
+	int slower;
+	int faster;
+
+	/** The columns that are left for the text of a line */
+	size_t width;
+
+	uint64_t start;
+	int numlines;
+	struct screen screen;
+	bool first;
+
+	/** The rows of the live group table below the bottom line, if shown */
+	size_t table;
+	uint64_t tabled;
+
+	struct counters stats;
+};
+
+static void winch(struct session *s) {
 	/* Get window size */
-	struct winsize w;
+	struct winsize w = {0};
 	ioctl(fileno(stdout), TIOCGWINSZ, &w);
 
-	/* Update buffer */
-	size_t bufsize = w.ws_col ? (w.ws_col - TS_WIDTH - SEP_WIDTH) : PIPE_BUF;
-	lb_resize(lb, bufsize);
+	/* Update buffers, which are narrower by however wide their tag is */
+	s->width = w.ws_col ? (w.ws_col - TS_WIDTH - SEP_WIDTH) : PIPE_BUF;
+	for (size_t i = 0; i < s->njobs; i++) {
+		struct job *job = s->jobs + i;
+		const size_t width = s->width > job->taglen ? s->width - job->taglen : 1;
+		if (job->out.lb) {
+			lb_resize(job->out.lb, width);
+		}
+		if (job->err.lb) {
+			lb_resize(job->err.lb, width);
+		}
+	}
+}
+
+/* The bottom line has scrolled away, or been drawn over with something else */
+static void scrolled(struct screen *screen) {
+	screen->st = NULL;
+	screen->tslen = 0;
+}
+
+/*
+ * Draw a timestamp at the start of the bottom line, with the cursor there. Only
+ * the digits that changed are sent, if it's clear what's there already, which
+ * is usually just the last few. Returns the column the cursor was left at.
+ */
+static size_t stamp(struct renderbuf *rb, struct screen *screen, uint64_t ns) {
+	char ts[TS_MAX];
+	const size_t len = rb_timestamp_format(ts, ns);
+
+	size_t same = 0;
+	if (len == screen->tslen) {
+		while (same < len && ts[same] == screen->ts[same]) {
+			same++;
+		}
+	}
+
+	/* Skipping over a few columns costs more than drawing them again */
+	if (same < CUF_MIN) {
+		same = 0;
+	}
+	if (same == len) {
+		return 0;
+	}
+
+	rb_forward(rb, same);
+	rb_append(rb, ts + same, len - same);
+	memcpy(screen->ts, ts, len);
+	screen->tslen = len;
+	return len;
+}
+
+/*
+ * Draw a line, or what is known of it so far, leaving the cursor at the start.
+ * When the bottom line already has the start of it, only the rest is sent.
+ * Whatever else was there is only cleared away if asked, since it's usually an
+ * earlier, shorter draw of the same line.
+ */
+static void draw(struct renderbuf *rb, struct screen *screen, uint64_t diff,
+                 const struct job *job, const struct stream *st,
+                 const struct lb_span *span, bool clear) {
+	const bool append = screen->st == st && !clear && !st->lb->moved &&
+	                    span->len >= screen->bytes;
+
+	if (append) {
+		/* A finished line gets its final timestamp drawn over this one anyway */
+		size_t col = span->end == LB_NEWLINE ? 0 : stamp(rb, screen, diff);
+		if (span->len > screen->bytes) {
+			const size_t text = screen->tslen + SEP_WIDTH + job->taglen + screen->cols;
+			rb_forward(rb, text - col);
+			rb_append(rb, lb_data(st->lb, span) + screen->bytes, span->len - screen->bytes);
+			col = text;
+		}
+		if (col) {
+			rb_puts(rb, "\r");
+		}
+	} else {
+		screen->tslen = 0;
+		stamp(rb, screen, diff);
+		rb_puts(rb, st->sep);
+		rb_append(rb, job->tag, job->taglen);
+		rb_append(rb, lb_data(st->lb, span), span->len);
+		if (clear) {
+			rb_puts(rb, CLEAR_EOL);
+		}
+		rb_puts(rb, "\r");
+	}
+
+	/* Only an unfinished line knows how wide it is so far */
+	screen->st = st;
+	screen->bytes = span->len;
+	screen->cols = span->end == LB_PARTIAL ? st->lb->col : 0;
+}
+
+/* Whether a stream is in the middle of a line */
+static bool unfinished(const struct stream *st) {
+	return st->lb && lb_partial(st->lb).len;
+}
+
+/* Summarize a single stream's distribution on one line */
+static void stream_summary(const char *label, const struct histogram *h) {
+	const struct timespec p50 = timespec_from_nsec(hist_percentile(h, 50.0));
+	const struct timespec p99 = timespec_from_nsec(hist_percentile(h, 99.0));
+	const struct timespec max = timespec_from_nsec(h->max);
+	printf("%-7s%6lu.%06lu p50, %lu.%06lu p99, %lu.%06lu max across %llu lines\n",
+	       label, p50.tv_sec, p50.tv_nsec / NSEC_PER_USEC,
+	       p99.tv_sec, p99.tv_nsec / NSEC_PER_USEC,
+	       max.tv_sec, max.tv_nsec / NSEC_PER_USEC,
+	       (unsigned long long)h->count);
+}
+
+/* Summarize a single job's run on one line, followed by its command */
+static void job_summary(const struct job *job) {
+	const struct timespec total = timespec_from_nsec(nsec_since(job->end, job->start));
+	const struct timespec p99 = timespec_from_nsec(hist_percentile(job->lat, 99.0));
+	const struct timespec max = timespec_from_nsec(job->lat->max);
+	printf("%-7.*s%6lu.%06lu across %d lines, %lu.%06lu p99, %lu.%06lu max:",
+	       (int)strcspn(job->tag, " "), job->tag, total.tv_sec, total.tv_nsec / NSEC_PER_USEC, job->numlines,
+	       p99.tv_sec, p99.tv_nsec / NSEC_PER_USEC,
+	       max.tv_sec, max.tv_nsec / NSEC_PER_USEC);
+	for (char **arg = job->argv; *arg; arg++) {
+		printf(" %s", *arg);
+	}
+	printf("\n");
+}
+
+/*
+ * Compare a finished line with how long it took in the baseline, if it was
+ * there, and pick the separator that shows how it went.
+ */
+static const char *compare(struct session *s, const struct stream *st,
+                           uint64_t diff, const char *text, size_t len) {
+	uint64_t before;
+	if (!baseline_match(s->baseline, text, len, &before)) {
+		return st->sep;
+	}
+	s->matched++;
+
+	const uint64_t margin = before / BASELINE_SHARE > BASELINE_MIN ?
+	                        before / BASELINE_SHARE : BASELINE_MIN;
+	if (diff > before + margin) {
+		s->slower++;
+		if (topn_beats(&s->regressions, diff, before)) {
+			topn_add(&s->regressions, diff, before, (uint64_t)s->numlines,
+			         st->id == REC_STDERR, text, len);
+		}
+		return SEP_FMT_SLOWER;
+	}
+	if (diff + margin < before) {
+		s->faster++;
+		return SEP_FMT_FASTER;
+	}
+	return st->sep;
+}
+
+/* Sum up the comparison with the baseline, and what got the most slower */
+static void baseline_summary(struct session *s) {
+	printf("Baseline: %d of %d lines matched, %d slower, %d faster\n",
+	       s->matched, s->numlines, s->slower, s->faster);
+	if (!s->regressions.len) {
+		return;
+	}
+
+	printf("Biggest regressions:\n");
+	topn_sort(&s->regressions);
+	for (size_t i = 0; i < s->regressions.len; i++) {
+		const struct topn_line *line = s->regressions.lines + i;
+		const struct timespec ts = timespec_from_nsec(line->duration);
+		const struct timespec more = timespec_from_nsec(line->duration - line->baseline);
+		printf("%6lu.%06lu  +%lu.%06lu  line %-8llu %s  ", ts.tv_sec,
+		       ts.tv_nsec / NSEC_PER_USEC, more.tv_sec, more.tv_nsec / NSEC_PER_USEC,
+		       (unsigned long long)line->index + 1, line->err ? "stderr" : "stdout");
+		fwrite(line->text, 1, line->len, stdout);
+		printf("\n");
+	}
+}
+
+/*
+ * Fill in the CPU use of a line that's done, in its tag, where the room was
+ * left for it ahead of however wide the columns after it are. Lines that were
+ * too quick to sample stay blank. Returns how far into the tag it drew.
+ */
+static size_t gauge(struct renderbuf *rb, const struct job *job, int cpu, size_t after) {
+	if (cpu < 0) {
+		return 0;
+	}
+
+	char field[16];
+	const int len = snprintf(field, sizeof(field), "%4d%%", cpu < 9999 ? cpu : 9999);
+	const size_t col = job->taglen - after - USAGE_WIDTH;
+	rb_forward(rb, col);
+	rb_puts(rb, COLOR_FAST);
+	rb_append(rb, field, (size_t)len);
+	rb_puts(rb, COLOR_RESET);
+	return col + (size_t)len;
+}
+
+/*
+ * Fill in the leaf commands that ran during a line that's done, at the end of
+ * its tag, from however far into the tag the cursor already is.
+ */
+static void annotate(struct renderbuf *rb, struct procs *p, const struct job *job,
+                     unsigned id, size_t col) {
+	char names[PROCS_WIDTH];
+	const size_t len = procs_leaves(p, id, names, sizeof(names));
+	if (!len) {
+		return;
+	}
+
+	rb_forward(rb, job->taglen - PROCS_WIDTH - col);
+	rb_puts(rb, COLOR_FAST);
+	rb_append(rb, names, len);
+	rb_puts(rb, COLOR_RESET);
+}
+
+/* Summarize what every job used, against how long they all took */
+static void usage_summary(const struct session *s, uint64_t elapsed) {
+	uint64_t cpu = 0, read = 0, written = 0, peak = 0;
+	for (size_t i = 0; i < s->njobs; i++) {
+		const struct resources *r = s->jobs[i].res;
+		if (r) {
+			cpu += r->cpu;
+			read += r->read;
+			written += r->written;
+			peak = r->peak > peak ? r->peak : peak;
+		}
+	}
+
+	const struct timespec total = timespec_from_nsec(cpu);
+	printf("CPU:   %6lu.%06lu, %llu%% of the total\n", total.tv_sec,
+	       total.tv_nsec / NSEC_PER_USEC,
+	       (unsigned long long)(elapsed ? cpu * 100 / elapsed : 0));
+	printf("Disk:  %llu kB read, %llu kB written\n",
+	       (unsigned long long)(read / 1024), (unsigned long long)(written / 1024));
+	printf("RSS:   %llu kB at most\n", (unsigned long long)(peak / 1024));
+}
+
+/* Account for a frame that has just been written out */
+static void flushed(struct counters *stats, uint64_t now) {
+	if (stats->pending) {
+		const uint64_t latency = nsec_since(now, stats->pending);
+		if (latency > stats->latency) {
+			stats->latency = latency;
+		}
+		stats->pending = 0;
+	}
+}
+
+/* Show the counters, along with those of the capture thread and renderer */
+static void counters(FILE *f, const struct session *s, const struct cap_stats *cs) {
+	const struct counters *c = &s->stats;
+	const struct timespec busy = timespec_from_nsec(c->busy);
+	const struct timespec waiting = timespec_from_nsec(c->waiting);
+	const struct timespec latency = timespec_from_nsec(c->latency);
+	fprintf(f, "Wakeups: %llu, %llu idle redraws\n",
+	        (unsigned long long)c->wakeups, (unsigned long long)c->redraws);
+	fprintf(f, "Reads:   %llu, %llu bytes, %d lines\n",
+	        (unsigned long long)cs->reads, (unsigned long long)cs->bytes, s->numlines);
+	fprintf(f, "Writes:  %llu, %llu bytes\n",
+	        (unsigned long long)s->rb->writes, (unsigned long long)s->rb->written);
+	fprintf(f, "Busy:    %6lu.%06lu, %lu.%06lu waiting\n",
+	        busy.tv_sec, busy.tv_nsec / NSEC_PER_USEC,
+	        waiting.tv_sec, waiting.tv_nsec / NSEC_PER_USEC);
+	fprintf(f, "Latency: %6lu.%06lu max, from read to write\n",
+	        latency.tv_sec, latency.tv_nsec / NSEC_PER_USEC);
+}
+
+/* Hand a line, or part of one, to the recorder */
+static void record(struct recorder *rec, const struct linebuffer *lb,
+                   const struct lb_span *span, uint64_t begin, uint64_t diff,
+                   enum rec_stream stream) {
+	switch (span->end) {
+		case LB_NEWLINE: {
+			rec_text(rec, stream, lb_data(lb, span), span->len);
+			rec_line(rec, begin, diff, stream);
+		} break;
+		case LB_WRAP: {
+			rec_text(rec, stream, lb_data(lb, span), span->len);
+			rec_wrap(rec, stream);
+		} break;
+		case LB_RETURN: {
+			rec_return(rec, stream);
+		} break;
+		case LB_PARTIAL: {
+			/* Partial lines get recorded once they are finished */
+		} break;
+	}
+}
+
+/* Draw the firehose summary over the current line, and maybe scroll past it */
+static void summarize(struct renderbuf *rb, struct firehose *fh,
+                      uint64_t now, size_t width, bool scroll) {
+	/* Show the rate across the whole summary, rather than the last window */
+	const uint64_t period = nsec_since(now, fh->scrolled);
+	const unsigned long long ms = period / NSEC_PER_MSEC;
+	const unsigned long long rate = ms ? fh->collapsed * 1000ULL / ms : 0;
+
+	char counts[64];
+	const int n = snprintf(counts, sizeof(counts), "[%lu lines, %llu/s] ",
+	                       fh->collapsed, rate);
+	const size_t prefix = (size_t)n < width ? (size_t)n : width;
+	const size_t room = width - prefix;
+
+	rb_timestamp(rb, period);
+	rb_puts(rb, SEP_FMT COLOR_FAST);
+	rb_append(rb, counts, prefix);
+	rb_puts(rb, COLOR_RESET);
+	rb_append(rb, fh->latest, fh->latestlen < room ? fh->latestlen : room);
+	rb_puts(rb, CLEAR_EOL);
+	rb_puts(rb, scroll ? "\n" : "\r");
+
+	fh_summarized(fh, now, scroll);
+}
+
+/*
+ * The live group table sits below the bottom line, so it has to be cleared out
+ * of the way before anything scrolls up into it.
+ */
+static void untable(struct session *s) {
+	if (s->table) {
+		rb_puts(s->rb, CLEAR_BELOW);
+		s->table = 0;
+	}
+}
+
+/* Draw the groups that have taken the longest so far below the bottom line */
+static void tabulate(struct session *s, uint64_t now) {
+	const struct group *top[GROUP_ROWS];
+	const size_t n = group_top(s->groups, top, GROUP_ROWS);
+
+	/* Rows that aren't there yet get scrolled into existence */
+	for (size_t i = 0; i < n; i++) {
+		char counts[32];
+		const int len = snprintf(counts, sizeof(counts), "[%lu lines] ", top[i]->lines);
+		const size_t prefix = (size_t)len < s->width ? (size_t)len : s->width;
+		const size_t room = s->width - prefix;
+		const size_t namelen = strlen(top[i]->name);
+
+		rb_puts(s->rb, "\n");
+		rb_timestamp(s->rb, top[i]->total);
+		rb_puts(s->rb, SEP_FMT COLOR_FAST);
+		rb_append(s->rb, counts, prefix);
+		rb_puts(s->rb, COLOR_RESET);
+		rb_append(s->rb, top[i]->name, namelen < room ? namelen : room);
+		rb_puts(s->rb, CLEAR_EOL);
+	}
+
+	/* Go back up to the bottom line, where everything else expects to be */
+	if (n) {
+		char up[32];
+		rb_append(s->rb, up, (size_t)snprintf(up, sizeof(up), "\x1b[%zuA\r", n));
+	}
+	s->table = n;
+	s->tabled = now;
+	s->groups->changed = false;
+}
+
+/*
+ * Draw, record, and account for a single read from one of the jobs. All of it
+ * is timed as of when the read returned, rather than when it gets drawn.
+ */
+static void output(struct session *s, struct job *job, int fd,
+                   const char *data, size_t len, uint64_t now) {
+	struct stream *st = fd == job->child.out ? &job->out : &job->err;
+	struct stream *other = st == &job->out ? &job->err : &job->out;
+
+	/*
+	 * Lines from several jobs can't share the bottom line of the screen, so
+	 * each is only drawn once it's done, rather than as it comes in.
+	 */
+	const bool partials = s->njobs == 1;
+
+	/* Now that something has come out, start showing times */
+	s->first = false;
+
+	/* The read may be larger than the linebuffer can take in one go */
+	for (size_t used = 0; used < len;) {
+		used += lb_append(st->lb, data + used, len - used);
+
+		/* Draw and finalize every line that the read completed */
+		struct lb_span span, latest = {0, 0, LB_PARTIAL};
+		while (lb_next(st->lb, &span)) {
+			const uint64_t diff = nsec_since(now, st->last);
+			const bool done = span.end == LB_NEWLINE;
+			const char *sep = st->sep;
+			int cpu = -1;
+
+			/* Record the line's timing, whether or not it gets drawn */
+			if (s->rec) {
+				record(s->rec, st->lb, &span, st->last - s->start, diff, st->id);
+			}
+
+			/*
+			 * Only the rows of a wrapped line need copying, since a line that
+			 * fits in one span can be used where it is once it's done.
+			 */
+			if (s->tracer || s->slowest.size || s->baseline) {
+				if (span.end == LB_RETURN) {
+					lb_text_clear(&st->text);
+				} else if (span.end == LB_WRAP || (done && st->text.len)) {
+					lb_text_append(&st->text, lb_data(st->lb, &span), span.len);
+				}
+			}
+
+			/*
+			 * A line is grouped by its first row, or by whatever overwrote it
+			 * after a carriage return, rather than by wherever the terminal
+			 * happened to split it.
+			 */
+			if (s->groups) {
+				if (span.end == LB_RETURN) {
+					st->group = NULL;
+					st->wrapped = false;
+				} else if (span.end != LB_PARTIAL) {
+					if (!st->wrapped && span.len) {
+						st->group = group_match(s->groups, lb_data(st->lb, &span), span.len);
+					}
+					st->wrapped = span.end == LB_WRAP;
+				}
+			}
+
+			if (done) {
+				/* Update running statistics */
+				hist_add(&s->lat->all, diff);
+				hist_add(st == &job->out ? &s->lat->out : &s->lat->err, diff);
+				if (job->lat) {
+					hist_add(job->lat, diff);
+				}
+				if (s->groups) {
+					group_line(s->groups, st->group, diff);
+					st->group = NULL;
+				}
+				if (job->res) {
+					cpu = res_tick(job->res, now, false);
+				}
+				if (s->procs) {
+					procs_tick(s->procs, now, false);
+				}
+				const char *text = st->text.len ? st->text.text : lb_data(st->lb, &span);
+				const size_t textlen = st->text.len ? st->text.len :
+				                       span.len < LB_TEXT ? span.len : LB_TEXT;
+				if (s->tracer) {
+					trace_line(s->tracer, (unsigned)(job - s->jobs) + 1,
+					           st->id == REC_STDERR, text, textlen,
+					           st->last - s->start, diff);
+				}
+				if (topn_beats(&s->slowest, diff, 0)) {
+					topn_add(&s->slowest, diff, 0, (uint64_t)s->numlines,
+					         st->id == REC_STDERR, text, textlen);
+				}
+				if (s->baseline) {
+					sep = compare(s, st, diff, text, textlen);
+				}
+				lb_text_clear(&st->text);
+
+				/*
+				 * Update the start-of-line timestamps we'll diff against. The
+				 * next line could come from either stream, unless the other
+				 * is already part way through one of its own.
+				 */
+				st->last = now;
+				if (!unfinished(other)) {
+					other->last = now;
+				}
+				job->numlines++;
+				s->numlines++;
+				fh_line(&s->fh);
+			}
+
+			/*
+			 * In firehose mode, only lines that are slow enough to be
+			 * interesting get drawn, the rest just get counted.
+			 */
+			if (s->fh.active) {
+				if (!done) {
+					continue;
+				}
+				latest = span;
+				if (diff < s->fh.slow) {
+					continue;
+				}
+				rb_puts(s->rb, CLEAR_EOL);
+				scrolled(&s->screen);
+			}
+
+			/*
+			 * What a carriage return overwrote would be left on the bottom
+			 * line, for another job's line to be drawn over without clearing
+			 * it, so with several jobs only what it ends up as gets drawn.
+			 */
+			if (!partials && span.end == LB_RETURN) {
+				continue;
+			}
+
+			/* Anything that scrolls needs the group table out of the way */
+			if (done || span.end == LB_WRAP) {
+				untable(s);
+			}
+
+			/* Normal idle timestamp update + linebuffer update */
+			draw(s->rb, &s->screen, diff, job, st, &span,
+			     s->screen.st && s->screen.st != st);
+
+			/* Finalize the previous line and advance */
+			if (done) {
+				/* Print the final timestamp for this line */
+				if(diff <= NSEC_PER_MSEC) {
+					rb_puts(s->rb, COLOR_FAST);
+				}
+				rb_timestamp(s->rb, diff);
+				rb_puts(s->rb, sep);
+				const size_t col = gauge(s->rb, job, cpu, s->procs ? PROCS_WIDTH : 0);
+				if (s->procs) {
+					annotate(s->rb, s->procs, job, (unsigned)(job - s->jobs), col);
+				}
+				rb_puts(s->rb, "\n");
+			} else if (span.end == LB_WRAP) {
+				/* Blank out the timestamp for this line, since it wraps */
+				rb_pad(s->rb, ' ', TS_WIDTH);
+				rb_puts(s->rb, st->sep);
+				rb_puts(s->rb, "\n");
+			}
+
+			/*
+			 * Anything but a carriage return leaves the bottom line empty. One
+			 * leaves the line there, to be drawn over from the start.
+			 */
+			if (span.end == LB_RETURN) {
+				s->screen.bytes = s->screen.cols = 0;
+			} else {
+				scrolled(&s->screen);
+			}
+		}
+
+		/* The summary shows the latest line, before its storage is recycled */
+		if (s->fh.active && latest.end == LB_NEWLINE) {
+			fh_latest(&s->fh, lb_data(st->lb, &latest), latest.len);
+		}
+	}
+
+	if (!partials || s->fh.active) {
+		scrolled(&s->screen);
+		return;
+	}
+
+	/*
+	 * Draw whatever is left of the unfinished line. If this stream doesn't
+	 * have one, the other stream's may need to be put back, after one of
+	 * this stream's lines pushed it up the screen.
+	 */
+	const struct stream *show = unfinished(st) ? st : unfinished(other) ? other : NULL;
+	if (show) {
+		const struct lb_span span = lb_partial(show->lb);
+		draw(s->rb, &s->screen, nsec_since(now, show->last), job, show, &span,
+		     s->screen.st && s->screen.st != show);
+	}
+}
+
+/* See if the rate of output calls for entering or leaving firehose mode */
+static void tick(struct session *s, uint64_t now) {
+	if (fh_tick(&s->fh, now) && !s->fh.active) {
+		/* Leave a final summary behind and go back to drawing every line */
+		untable(s);
+		summarize(s->rb, &s->fh, now, s->width, true);
+		scrolled(&s->screen);
+	}
+}
+
+/* Find the job that a descriptor belongs to, as long as it's still open */
+static struct job *job_for(struct session *s, int fd) {
+	for (size_t i = 0; i < s->njobs; i++) {
+		struct job *job = s->jobs + i;
+		if (job->state != JOB_PENDING &&
+		    (job->child.out == fd || job->child.err == fd)) {
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Handle every read that the capture thread has queued up, and count down
+ * the descriptors as they finish. Returns whether there were any.
+ */
+static bool consume(struct session *s, struct capture *cap) {
+	bool activity = false;
+	struct chunk chunk;
+	while (cap_next(cap, &chunk)) {
+		struct job *job = job_for(s, chunk.fd);
+		activity = job->activity = true;
+		if (!s->stats.pending) {
+			s->stats.pending = chunk.when;
+		}
+		if (chunk.len) {
+			output(s, job, chunk.fd, chunk.data, chunk.len, chunk.when);
+		} else {
+			/*
+			 * This stream is drained, but the other may not be. The capture
+			 * thread is done with it, so the descriptor can be recycled.
+			 */
+			close(chunk.fd);
+			if (job->child.out == chunk.fd) {
+				job->child.out = -1;
+			} else {
+				job->child.err = -1;
+			}
+			job->open--;
+		}
+		cap_release(cap, &chunk);
+
+		/*
+		 * A backlog can run to megabytes, so don't wait until all of it has
+		 * been drawn to notice that it is a flood.
+		 */
+		tick(s, clk_now());
+	}
+	return activity;
+}
+
+/* Whether a job times something that is already running, rather than a command */
+static bool job_streamed(const struct job *job) {
+	return !strcmp(job->argv[0], STREAM_JOB);
+}
+
+/* Spawn a job, or attach to its stream, and start capturing its output */
+static void job_start(struct session *s, struct job *job, struct eventloop *loop,
+                      struct capture *cap, bool usepty) {
+	if (job_streamed(job)) {
+		/* There's nobody to wait on, so the end of the stream is the end */
+		const char *source = job->argv[1] ? job->argv[1] : STREAM_STDIN;
+		job->child = (struct descendent){ .pid = 0, .out = attach(source), .err = -1 };
+		job->open = 1; /* child.out */
+	} else {
+		job->child = spawn(job->argv, usepty, loop);
+		job->open = 2; /* child.out and child.err */
+	}
+	job->start = job->out.last = job->err.last = clk_now();
+	job->state = JOB_RUNNING;
+	s->running++;
+
+	job->out.sep = SEP_FMT;
+	job->out.id = REC_STDOUT;
+	job->err.sep = SEP_FMT_ERR;
+	job->err.id = REC_STDERR;
+
+	/* Streams that there's nothing to read from don't need anywhere to put it */
+	const size_t width = s->width > job->taglen ? s->width - job->taglen : 1;
+	job->out.lb = lb_create();
+	lb_resize(job->out.lb, width);
+	if (job->child.err != -1) {
+		job->err.lb = lb_create();
+		lb_resize(job->err.lb, width);
+	}
+
+	if (s->tracer) {
+		trace_process(s->tracer, (unsigned)(job - s->jobs) + 1, job->argv);
+	}
+
+	if (job->child.pid) {
+		el_watch_child(loop, job->child.pid);
+	}
+	if (s->procs && job->child.pid) {
+		procs_watch(s->procs, job->child.pid, (unsigned)(job - s->jobs));
+	}
+
+	/* Only a command of its own has anything to follow */
+	if (s->resources && job->child.pid) {
+		if (!(job->res = malloc(sizeof(struct resources)))) {
+			err(EX_OSERR, "malloc");
+		}
+		if (!res_init(job->res, job->child.pid, job->start)) {
+			res_destroy(job->res);
+			free(job->res);
+			job->res = NULL;
+		}
+	}
+	cap_watch(cap, job->child.out);
+	if (job->child.err != -1) {
+		cap_watch(cap, job->child.err);
+	}
+}
+
+/*
+ * When the line on the bottom of the screen started, for showing its age while
+ * it waits. With nothing there, the next line starts as of the last one.
+ */
+static uint64_t origin(const struct session *s) {
+	return s->screen.st ? s->screen.st->last : s->jobs[0].out.last;
+}
+
+/* Answer a scrape of the metrics socket, or take a new connection to it */
+static void scrape(struct session *s, int fd, uint64_t now) {
+	const struct metrics_snapshot snap = {
+		.lat = &s->lat->all,
+		.runtime = nsec_since(now, s->start),
+		.age = s->first ? 0 : nsec_since(now, origin(s)),
+	};
+	metrics_serve(s->metrics, fd, &snap, now);
+}
+
+/*
+ * Work out when the display next needs attention, in nanoseconds, or 0 if it
+ * can wait for the jobs to say something. Idle lines only count when their
+ * timestamps are being redrawn at all.
+ */
+static uint64_t schedule(const struct session *s, uint64_t now,
+                         bool idle, bool dead) {
+	uint64_t due = 0;
+
+	/* Come back around to see whether a dead child's output has dried up */
+	if (dead) {
+		due = now + REAP_DELAY;
+	}
+
+	uint64_t next = 0;
+	if (s->fh.active) {
+		next = fh_due(&s->fh);
+	} else if (idle && !s->first) {
+		/* Wake up right as the digits being shown next change */
+		const uint64_t last = origin(s);
+		const uint64_t age = nsec_since(now, last);
+		size_t i = 0;
+		while (age >= backoff[i].age) {
+			i++;
+		}
+		next = last + (age / backoff[i].step + 1) * backoff[i].step;
+	}
+
+	if (next && (!due || next < due)) {
+		due = next;
+	}
+
+	/* Walk the process tree during quiet spells too, or nothing notices them */
+	if (s->procs) {
+		next = procs_due(s->procs);
+		if (!due || next < due) {
+			due = next;
+		}
+	}
+
+	/* Likewise for the lines per second, which would otherwise go stale */
+	if (s->metrics) {
+		next = metrics_due(s->metrics);
+		if (!due || next < due) {
+			due = next;
+		}
+	}
+	return due;
 }
 
 static __attribute__((noreturn)) void usage(const char *progname) {
-	errx(EX_USAGE, "usage: %s [-lp] command [arg0 ...]", progname);
+	errx(EX_USAGE, "usage: %s [-lpsuv] [-c clock] [-f lines] [-g regex] [-j jobs] [-n count]\n"
+	               "            [-o file] [-t msec] [--baseline file]\n"
+	               "            [--trace file [--trace-begin regex] [--trace-end regex]]\n"
+	               "            [--metrics-socket path] command [arg0 ...] [::: command [arg0 ...] ...]\n"
+	               "       %s [-lv] [-c clock] [-f lines] [-g regex] [-n count] [-o file]\n"
+	               "            [-t msec] [--baseline file]\n"
+	               "            [--trace file [--trace-begin regex] [--trace-end regex]]\n"
+	               "            [--metrics-socket path] - [fd | file]\n"
+	               "       %s report [-n count] file", progname, progname, progname);
+}
+
+static unsigned long number(const char *str, const char *progname) {
+	char *end;
+	const unsigned long result = strtoul(str, &end, 10);
+	if (!*str || *end) {
+		warnx("Invalid number: %s", str);
+		usage(progname);
+	}
+	return result;
+}
+
+/*
+ * Split the command line into jobs at every ":::", each getting its own NULL
+ * terminated argv. Returns how many there are.
+ */
+static size_t split(int argc, char * const argv[], struct job **jobs,
+                    const char *progname) {
+	/* Every separator becomes a NULL terminator, plus one more at the end */
+	char **args = malloc((size_t)(argc + 1) * sizeof(char *));
+	*jobs = calloc((size_t)argc + 1, sizeof(struct job));
+	if (!args || !*jobs) {
+		err(EX_OSERR, "malloc");
+	}
+
+	size_t njobs = 0;
+	char **begin = args, **cur = args;
+	for (int i = 0; i <= argc; i++) {
+		if (i < argc && strcmp(argv[i], ":::")) {
+			*cur++ = argv[i];
+			continue;
+		}
+
+		/* Make sure we were actually given a command */
+		if (cur == begin) {
+			warnx("You must specify a command.");
+			usage(progname);
+		}
+
+		/* A stream only ever comes from the one place */
+		if (!strcmp(*begin, STREAM_JOB) && cur - begin > 2) {
+			warnx("Only one stream can be read by %s.", STREAM_JOB);
+			usage(progname);
+		}
+		*cur++ = NULL;
+		(*jobs)[njobs++].argv = begin;
+		begin = cur;
+	}
+	return njobs;
 }
 
 int main(int argc, char * const argv[]) {
 	bool slow = false;
 	bool usepty = true;
+	bool verbose = false;
+	bool resources = false;
+	bool subprocesses = false;
+	unsigned long firehose = FIREHOSE_RATE;
+	unsigned long firehoseslow = FIREHOSE_SLOW;
+	unsigned long parallel = 0;
+	unsigned long slowest = SLOWEST;
+	const char *recording = NULL;
+	const char *tracing = NULL;
+	const char *socketpath = NULL;
+	const char *baseline = NULL;
+	const char *begin = NULL, *end = NULL;
+	struct groups *groups = NULL;
 	const char * const progname = argv[0];
 
+	/* Subcommands take over entirely */
+	if (argc > 1 && !strcmp(argv[1], "report")) {
+		return report(progname, argc - 1, argv + 1);
+	}
+
 	/* Process any command line flags */
+	enum {
+		OPT_TRACE = 256,
+		OPT_TRACE_BEGIN,
+		OPT_TRACE_END,
+		OPT_METRICS_SOCKET,
+		OPT_BASELINE,
+	};
+	static const struct option longopts[] = {
+		{ "group", required_argument, NULL, 'g' },
+		{ "trace", required_argument, NULL, OPT_TRACE },
+		{ "trace-begin", required_argument, NULL, OPT_TRACE_BEGIN },
+		{ "trace-end", required_argument, NULL, OPT_TRACE_END },
+		{ "metrics-socket", required_argument, NULL, OPT_METRICS_SOCKET },
+		{ "baseline", required_argument, NULL, OPT_BASELINE },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	/* The first non-option is the command, and the rest of it is its own */
 	int ch;
-	while ((ch = getopt(argc, argv, "lp")) != -1) {
+	while ((ch = getopt_long(argc, argv, "+c:f:g:j:ln:o:pst:uv", longopts, NULL)) != -1) {
 		switch (ch) {
+			case 'c': {
+				if (!clk_select(optarg)) {
+					warnx("Unknown or unavailable clock: %s", optarg);
+					usage(progname);
+				}
+			} break;
+			case 'f': {
+				firehose = number(optarg, progname);
+			} break;
+			case 'g': {
+				if (!groups) {
+					if (!(groups = malloc(sizeof(struct groups)))) {
+						err(EX_OSERR, "malloc");
+					}
+					group_init(groups);
+				}
+				if (!group_add(groups, optarg)) {
+					usage(progname);
+				}
+			} break;
+			case 'j': {
+				if (!(parallel = number(optarg, progname))) {
+					warnx("There must be at least one job at a time.");
+					usage(progname);
+				}
+			} break;
+			case 'n': {
+				slowest = number(optarg, progname);
+			} break;
+			case 't': {
+				firehoseslow = number(optarg, progname);
+			} break;
+			case 'o': {
+				recording = optarg;
+			} break;
 			case 'p': {
 				usepty = false;
 			} break;
 			case 'l': {
 				slow = true;
 			} break;
+			case 's': {
+				subprocesses = true;
+			} break;
+			case 'u': {
+				resources = true;
+			} break;
+			case 'v': {
+				verbose = true;
+			} break;
+			case OPT_TRACE: {
+				tracing = optarg;
+			} break;
+			case OPT_TRACE_BEGIN: {
+				begin = optarg;
+			} break;
+			case OPT_TRACE_END: {
+				end = optarg;
+			} break;
+			case OPT_METRICS_SOCKET: {
+				socketpath = optarg;
+			} break;
+			case OPT_BASELINE: {
+				baseline = optarg;
+			} break;
 			default: {
 				usage(progname);
 			} break;
@@ -100,170 +1188,427 @@ int main(int argc, char * const argv[]) {
 	argc -= optind;
 	argv += optind;
 
-	/* Make sure we were actually given a command */
-	if (argc == 0) {
-		warnx("You must specify a command.");
+	/* Every command gets a job, and they all run at once unless limited */
+	struct session s = {
+		.numlines = 0,
+		.first = true,
+		.groups = groups,
+		.resources = resources,
+	};
+	s.njobs = split(argc, argv, &s.jobs, progname);
+	topn_init(&s.slowest, slowest, LB_TEXT);
+	topn_init(&s.regressions, REGRESSIONS, LB_TEXT);
+	s.parallel = parallel && parallel < s.njobs ? parallel : s.njobs;
+
+	/* A recording only has room for one command's lines */
+	if (recording && s.njobs > 1) {
+		warnx("Only a single command can be recorded.");
 		usage(progname);
 	}
 
-	/* Spawn the child and hook the pipes up */
-	const struct descendent child = spawn(argv, usepty);
+	/* Tag the jobs to tell their lines apart, all the same width */
+	if (s.njobs > 1) {
+		const int width = snprintf(NULL, 0, "[%zu] ", s.njobs);
+		for (size_t i = 0; i < s.njobs; i++) {
+			struct job *job = s.jobs + i;
+			char label[24];
+			snprintf(label, sizeof(label), "[%zu]", i + 1);
+			job->taglen = (size_t)snprintf(job->tag, sizeof(job->tag), "%-*s", width, label);
+			if (!(job->lat = malloc(sizeof(struct histogram)))) {
+				err(EX_OSERR, "malloc");
+			}
+			hist_init(job->lat);
+		}
+	}
 
-	/* Get everything ready for kqueue */
-	struct kevent ev[EVENT_COUNT];
-	EV_SET(ev + 0, child.out, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-	EV_SET(ev + 1, child.err, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-	EV_SET(ev + 2, child.pid, EVFILT_PROC, EV_ADD | EV_ENABLE, 0, 0, NULL);
+	/* Leave room at the end of each tag for the CPU use of each line */
+	if (resources) {
+		for (size_t i = 0; i < s.njobs; i++) {
+			struct job *job = s.jobs + i;
+			memset(job->tag + job->taglen, ' ', USAGE_WIDTH);
+			job->taglen += USAGE_WIDTH;
+			job->tag[job->taglen] = '\0';
+		}
+	}
+
+	/*
+	 * Become a subreaper before anything is spawned, and leave room after all
+	 * of that for the commands that ran during each line.
+	 */
+	if (subprocesses && !(s.procs = procs_open(clk_now()))) {
+		warnx("Subprocesses can't be followed on this system.");
+	}
+	if (s.procs) {
+		for (size_t i = 0; i < s.njobs; i++) {
+			struct job *job = s.jobs + i;
+			memset(job->tag + job->taglen, ' ', PROCS_WIDTH);
+			job->taglen += PROCS_WIDTH;
+			job->tag[job->taglen] = '\0';
+		}
+	}
+
+	/* Markers only mean anything in a trace */
+	if ((begin || end) && !tracing) {
+		warnx("Span markers can only be given along with --trace.");
+		usage(progname);
+	}
+
+	/* Open the recording first, so that a bad path fails before anything runs */
+	s.rec = recording ? rec_open(recording) : NULL;
+	s.tracer = tracing ? trace_open(tracing) : NULL;
+	if (s.tracer && !trace_markers(s.tracer, begin, end)) {
+		usage(progname);
+	}
+	s.baseline = baseline ? baseline_open(baseline) : NULL;
+
+	/* Get everything ready for the event loop */
+	struct eventloop *loop = el_create();
 
-	const int kq = kqueue();
-	if (kq == -1) {
-		err(EX_OSERR, "kqueue");
+	/* Orphans that a subreaper takes in are left for us to wait on */
+	if (s.procs) {
+		el_reap_all(loop);
 	}
 
-	/* Timestamp the process start */
-	struct timespec last;
-	clock_gettime(CLOCK_MONOTONIC, &last);
-	const struct timespec start = last;
+	/* Allocate the frame buffer that everything gets drawn into */
+	s.rb = rb_create(fileno(stdout));
 
-	/* Allocate line buffer */
-	struct linebuffer *lb = lb_create();
+	/* Fixed-size distributions of line durations, no matter how many lines */
+	s.lat = malloc(sizeof(struct latency));
+	if (!s.lat) {
+		err(EX_OSERR, "malloc");
+	}
+	hist_init(&s.lat->all);
+	hist_init(&s.lat->out);
+	hist_init(&s.lat->err);
+
+	/* Serve metrics from the same loop, so they're never out of date */
+	s.metrics = socketpath ? metrics_open(socketpath, loop, clk_now()) : NULL;
 
 	/* Set up terminal width info tracking */
-	winch(lb);
-	EV_SET(ev + 3, SIGWINCH, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+	winch(&s);
+	el_watch_signal(loop, SIGWINCH);
 
 	/*
 	 * Catch SIGINT to make sure we get a chance to print final stats.
-	 * The signal needs to be masked to ignore first, otherwise it will
-	 * terminate the process before ever getting to the kqueue.
+	 * The event loop takes the signal away from its default disposition,
+	 * otherwise it will terminate the process before we ever see it.
 	 */
-	signal(SIGINT, SIG_IGN);
-	EV_SET(ev + 4, SIGINT, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+	el_watch_signal(loop, SIGINT);
 
-	/* Set the events to listen for */
-	int nev = kevent(kq, ev, EVENT_COUNT, NULL, 0, NULL);
-	if (nev == -1) {
-		err(EX_IOERR, "kevent (set)");
-	}
-
-	/* The main kevent loop */
-	bool wrap = false;
-	bool nl = true;
-	bool first = true;
-	bool dead = false;
-	struct kevent triggered;
-	struct timespec now, max = {0,0};
-	int numlines = 0;
-	const char *lastsep = SEP_FMT;
-	for (nev = 0; nev != -1; nev = kevent(kq, NULL, 0, &triggered, 1, &timeout)) {
-		/* Get the timestamp of this output, and calculate the offset */
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		const struct timespec diff = timespec_subtract(&now, &last);
+	/* Show how tach itself is doing on request, without stopping anything */
+	el_watch_signal(loop, SIGUSR1);
 
-		/*
-		 * Handle the triggering event.
-		 * The triggered structure shall not be accessed outside this block.
-		 */
-		if (nev) {
-			assert(nev == 1);
+	/*
+	 * Hand reading the jobs' output off to its own thread, and wait on it
+	 * for new output instead.
+	 */
+	s.start = clk_now();
 
-			/* Is the child done? */
-			if (triggered.flags & EV_EOF) {
-				dead = true;
-			}
+	/* Lines that go to a file or a pipe are all kept, however fast they come */
+	const bool tty = isatty(fileno(stdout));
+	fh_init(&s.fh, tty ? firehose : 0, (uint64_t)firehoseslow * NSEC_PER_MSEC, s.start);
+	struct capture *cap = cap_start();
+	el_watch_fd(loop, cap_fd(cap));
 
-			/* Did we get a signal? */
-			if (triggered.filter == EVFILT_SIGNAL) {
-				switch (triggered.ident) {
-					case SIGWINCH:
-						winch(lb);
-						continue;
-					case SIGINT:
-						dead = true;
-				}
-			}
+	/* Spawn the first jobs and hook the pipes up */
+	size_t next = 0;
+	while (next < s.parallel) {
+		job_start(&s, s.jobs + next++, loop, cap, usepty);
+	}
 
-			/* Did the child exit? */
-			if (triggered.filter == EVFILT_PROC && triggered.fflags & NOTE_EXIT) {
-				dead = true;
-			}
+	/* Idle timestamps are only worth redrawing on a terminal, outside of -l */
+	const bool idle = !slow && s.njobs == 1 && tty;
 
-			/* Did the child say something? */
-			if (triggered.filter == EVFILT_READ) {
-				/* Figure out which fd it is, and assign the fd-specific variables */
-				const int fd = (int)triggered.ident;
-				const char *sep = (fd == child.out ? SEP_FMT : SEP_FMT_ERR);
+	/* The same goes for the live group table */
+	const bool table = s.groups && !slow && tty;
+	uint64_t armed = 0;
 
-				/* Read the triggering event */
-				if(!lb_read(lb, fd, &nl)) {
-					if (dead) {
-						break;
-					}
-					err(EX_IOERR, "read");
-				}
-				wrap = lb_full(lb);
+	/* Some things can't wait for the first output, like following subprocesses */
+	const uint64_t first = schedule(&s, s.start, idle, false);
+	if (first) {
+		const struct timespec after = timespec_from_nsec(nsec_since(first, clk_now()));
+		el_timer(loop, &after);
+		armed = first;
+	}
 
-				/* Now that something has come out, start showing times */
-				first = false;
+	/* The main event loop */
+	bool interrupted = false;
+	struct event triggered[EVENT_COUNT];
+	uint64_t now;
+	int nev;
+	uint64_t slept = clk_now(), woke = slept;
+	while ((nev = el_wait(loop, triggered, EVENT_COUNT, cap_arm(cap))) != -1) {
+		woke = clk_now();
+		s.stats.wakeups++;
+		s.stats.waiting += nsec_since(woke, slept);
 
-				/* Normal idle timestamp update + linebuffer update */
-				printf(TS_FMT "%s%s\r", TS_ARG(diff), sep, lb->buf);
+		/* Which jobs were already gone before this batch came in? */
+		for (size_t i = 0; i < s.njobs; i++) {
+			s.jobs[i].wasdead = s.jobs[i].dead;
+			s.jobs[i].activity = false;
+		}
 
-				/* Finalize the previous line and advance */
-				if (nl || wrap) {
-					if (nl) {
-						/* Print the final timestamp for this line */
-						if(diff.tv_sec == 0 && diff.tv_nsec <= NSEC_PER_MSEC) {
-							printf(COLOR_FAST);
-						}
-						printf(TS_FMT "%s", TS_ARG(diff), lastsep);
+		/*
+		 * Handle the triggering events.
+		 * The triggered structures shall not be accessed outside this block.
+		 */
+		for (int i = 0; i < nev; i++) {
+			const struct event *e = triggered + i;
 
-						/* Update running statistics */
-						if (timespec_compare(&diff, &max)) {
-							max = diff;
+			switch (e->type) {
+				case EVENT_SIGNAL: {
+					/* Did we get a signal? */
+					switch (e->ident) {
+						case SIGWINCH:
+							winch(&s);
+							break;
+						case SIGUSR1: {
+							struct cap_stats cs;
+							cap_stats(cap, &cs);
+							counters(stderr, &s, &cs);
+						} break;
+						case SIGINT:
+							/* Everything that's running is as good as dead */
+							interrupted = true;
+							for (size_t j = 0; j < s.njobs; j++) {
+								s.jobs[j].dead = true;
+							}
+					}
+				} break;
+				case EVENT_EXIT: {
+					/* One of the jobs exited */
+					for (size_t j = 0; j < s.njobs; j++) {
+						if (s.jobs[j].state == JOB_RUNNING &&
+						    s.jobs[j].child.pid == e->ident) {
+							s.jobs[j].dead = true;
 						}
-
-						/* Update the start-of-line timestamp we'll diff against */
-						last = now;
-						numlines++;
-					} else if (wrap) {
-						/* Blank out the timestamp for this line, since it wraps */
-						printf("%*s%s", TS_WIDTH, "", lastsep);
 					}
+				} break;
+				case EVENT_TIMER: {
+					/* Idle updates happen below, once the batch is handled */
+					armed = 0;
+				} break;
+				case EVENT_READ: {
+					/* Scrapes are answered right away, output is handled below */
+					if (s.metrics && metrics_owns(s.metrics, e->ident)) {
+						scrape(&s, e->ident, clk_now());
+					}
+				} break;
+			}
+		}
 
-					printf("\n");
+		/* The jobs said something, maybe quite a lot while we were drawing */
+		const bool activity = consume(&s, cap);
 
-					/* We have successfully flushed this line to the terminal */
-					lb_reset(lb);
-				}
+		/*
+		 * Every read was timestamped as it happened, so the time only needs
+		 * to be taken now for idle updates, after all of them.
+		 */
+		now = clk_now();
+
+		/* Output that has stopped can still bring firehose mode to an end */
+		tick(&s, now);
+		if (s.procs) {
+			procs_tick(s.procs, now, false);
+		}
+		if (s.metrics) {
+			metrics_tick(s.metrics, s.lat->all.count, now);
+		}
+
+		/*
+		 * A job is finished once its streams are drained, or once it's dead
+		 * and a whole batch went by without a peep out of it, in case
+		 * something it left behind is holding them open.
+		 */
+		bool dead = false;
+		for (size_t i = 0; i < s.njobs; i++) {
+			struct job *job = s.jobs + i;
+			if (job->state != JOB_RUNNING) {
+				continue;
+			}
+			if (!job->open || (job->wasdead && !job->activity)) {
+				job->state = JOB_DONE;
+				job->end = now;
+				s.running--;
 
-				/* Store this separator for blanking out before the newline */
-				lastsep = sep;
+				/* Whatever it used since its last line counts too */
+				if (job->res) {
+					res_tick(job->res, now, true);
+				}
+			} else {
+				dead |= job->dead;
 			}
-		} else if (dead) {
-			/* Child is dead and events have been exhausted */
+		}
+
+		/* Make room for the next jobs in line */
+		while (!interrupted && next < s.njobs && s.running < s.parallel) {
+			job_start(&s, s.jobs + next++, loop, cap, usepty);
+		}
+
+		if (!s.running) {
+			/* Every job is dead and events have been exhausted */
 			break;
-		} else if (!first && !slow) {
-			/* Normal idle timestamp update */
-			printf(TS_FMT "\r", TS_ARG(diff));
+		} else if (s.fh.active) {
+			/* Rate-limited summary update, scrolling now and again */
+			if (fh_scroll(&s.fh, now)) {
+				untable(&s);
+				summarize(s.rb, &s.fh, now, s.width, true);
+			} else if (fh_redraw(&s.fh, now)) {
+				summarize(s.rb, &s.fh, now, s.width, false);
+			}
+			scrolled(&s.screen);
+		} else if (!activity && !s.first && idle) {
+			/* Normal idle timestamp update, of just the digits that changed */
+			if (stamp(s.rb, &s.screen, nsec_since(now, origin(&s)))) {
+				rb_puts(s.rb, "\r");
+			}
+			s.stats.redraws++;
+		}
+
+		/*
+		 * Put the group table back once lines have scrolled it away, and
+		 * otherwise keep it up to date at a sensible rate.
+		 */
+		if (table && (!s.table || (s.groups->changed &&
+		              nsec_since(now, s.tabled) >= GROUP_REDRAW))) {
+			tabulate(&s, now);
 		}
-		fflush(stdout);
+
+		/* Everything drawn for this batch goes out at once */
+		rb_flush(s.rb);
+		flushed(&s.stats, clk_now());
+
+		/*
+		 * Sleep until the display next needs attention. A timer that is set
+		 * to go off sooner is left alone, since waking up early is harmless,
+		 * and much cheaper than rearming it for every batch of output.
+		 */
+		const uint64_t due = schedule(&s, now, idle, dead);
+		if (due && (!armed || due < armed)) {
+			const struct timespec after = timespec_from_nsec(nsec_since(due, now));
+			el_timer(loop, &after);
+			armed = due;
+		}
+
+		slept = clk_now();
+		s.stats.busy += nsec_since(slept, woke);
 	}
 
-	/* Did we exit the loop because of a kevent error? */
+	/* Did we exit the loop because of an event loop error? */
 	if (nev == -1) {
-		err(EX_IOERR, "kevent");
+		err(EX_IOERR, "el_wait");
 	}
 
+	/* The last wakeup broke out of the loop before it could be counted */
+	s.stats.busy += nsec_since(clk_now(), woke);
+
+	/* Take anything that snuck in before the end, then stop reading */
+	consume(&s, cap);
+	struct cap_stats cs;
+	cap_stats(cap, &cs);
+	cap_stop(cap);
+
 	/* Final timestamp, just in case we spent time waiting on a signal or EOF */
-	clock_gettime(CLOCK_MONOTONIC, &now);
+	now = clk_now();
+
+	/* Don't leave a stale firehose summary or group table behind */
+	untable(&s);
+	if (s.fh.active) {
+		summarize(s.rb, &s.fh, now, s.width, true);
+	}
 
-	/* Cleanup */
-	lb_destroy(lb);
+	/* Flush anything left over from breaking out of the loop, then cleanup */
+	rb_flush(s.rb);
+	flushed(&s.stats, clk_now());
+	fh_destroy(&s.fh);
+	if (s.metrics) {
+		metrics_close(s.metrics);
+	}
+	el_destroy(loop);
 
 	/* Final statistics */
-	const struct timespec total = timespec_subtract(&now, &start);
-	printf("Total: %6lu.%06lu across %u lines\n", total.tv_sec, total.tv_nsec / NSEC_PER_USEC, numlines);
+	const uint64_t elapsed = nsec_since(now, s.start);
+	if (s.rec) {
+		rec_close(s.rec, elapsed);
+	}
+	if (s.tracer) {
+		trace_close(s.tracer, elapsed);
+	}
+	if (s.procs) {
+		procs_tick(s.procs, now, true);
+	}
+	const struct timespec total = timespec_from_nsec(elapsed);
+	printf("Total: %6lu.%06lu across %u lines\n", total.tv_sec, total.tv_nsec / NSEC_PER_USEC, s.numlines);
+	const struct timespec max = timespec_from_nsec(s.lat->all.max);
 	printf("Max:   %6lu.%06lu\n", max.tv_sec, max.tv_nsec / NSEC_PER_USEC);
+	if (verbose) {
+		counters(stdout, &s, &cs);
+	}
+	if (s.resources) {
+		usage_summary(&s, elapsed);
+	}
+	if (s.numlines) {
+		hist_print_percentiles(&s.lat->all, stdout);
+
+		/* Only bother splitting them up when both streams had something */
+		if (s.lat->out.count && s.lat->err.count) {
+			stream_summary("stdout:", &s.lat->out);
+			stream_summary("stderr:", &s.lat->err);
+		}
+
+		hist_print(&s.lat->all, stdout);
+
+		if (s.groups) {
+			group_print(s.groups, stdout);
+		}
+
+		if (s.slowest.len) {
+			printf("Slowest lines:\n");
+			topn_print(&s.slowest, stdout);
+		}
+	}
+	if (s.procs) {
+		printf("Commands:\n");
+		procs_print(s.procs, elapsed, stdout);
+	}
+	if (s.baseline) {
+		baseline_summary(&s);
+	}
+
+	/* With several jobs, each gets a line of its own, in the order given */
+	for (size_t i = 0; i < s.njobs; i++) {
+		struct job *job = s.jobs + i;
+		if (job->lat && job->state == JOB_DONE) {
+			job_summary(job);
+		}
+		if (job->out.lb) {
+			lb_destroy(job->out.lb);
+		}
+		if (job->err.lb) {
+			lb_destroy(job->err.lb);
+		}
+		if (job->res) {
+			res_destroy(job->res);
+			free(job->res);
+		}
+		free(job->lat);
+	}
+
+	free(s.jobs[0].argv);
+	free(s.jobs);
+	free(s.lat);
+	topn_destroy(&s.slowest);
+	topn_destroy(&s.regressions);
+	if (s.baseline) {
+		baseline_close(s.baseline);
+	}
+	if (s.procs) {
+		procs_close(s.procs);
+	}
+	if (s.groups) {
+		group_destroy(s.groups);
+		free(s.groups);
+	}
+	rb_destroy(s.rb);
 	return EX_OK;
 }
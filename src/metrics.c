@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "metrics.h"
+#include "event.h"
+#include "histogram.h"
+#include "time.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/* Room for the whole response, which only grows with the number of metrics */
+#define METRICS_MAX  (4096)
+
+/* How long lines are counted for, for the rate */
+#define METRICS_RATE (NSEC_PER_SEC)
+
+/* How many connections can wait on their requests at once */
+#define METRICS_CONNS (16)
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL (0) /* SO_NOSIGPIPE is set on each connection instead */
+#endif
+
+struct metrics {
+	struct eventloop *loop;
+	int fd;
+	char *path;
+	/** Connections that haven't sent their request yet, or -1 */
+	int conns[METRICS_CONNS];
+	/** Lines per second, counted over the last window that's over */
+	uint64_t rate;
+	/** When the current window started, and how many lines were done by then */
+	uint64_t window;
+	uint64_t count;
+	bool rated;
+};
+
+/* Set a descriptor to be closed on exec and never block */
+static void unblock(int fd) {
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+		err(EX_OSERR, "fcntl");
+	}
+}
+
+struct metrics *metrics_open(const char *path, struct eventloop *loop, uint64_t now) {
+	struct metrics *m = calloc(sizeof(struct metrics), 1);
+	if (!m || !(m->path = strdup(path))) {
+		err(EX_OSERR, "malloc");
+	}
+	m->loop = loop;
+	m->window = now;
+	for (size_t i = 0; i < METRICS_CONNS; i++) {
+		m->conns[i] = -1;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errx(EX_USAGE, "%s: Socket path is too long", path);
+	}
+	strcpy(addr.sun_path, path);
+
+	/* A socket from an earlier run can be replaced, but nothing else */
+	struct stat st;
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	if ((m->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		err(EX_OSERR, "socket");
+	}
+	if (bind(m->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(m->fd, SOMAXCONN) == -1) {
+		err(EX_CANTCREAT, "%s", path);
+	}
+	unblock(m->fd);
+	el_watch_fd(loop, m->fd);
+
+	return m;
+}
+
+void metrics_close(struct metrics *m) {
+	for (size_t i = 0; i < METRICS_CONNS; i++) {
+		if (m->conns[i] != -1) {
+			close(m->conns[i]);
+		}
+	}
+	close(m->fd);
+	unlink(m->path);
+	free(m->path);
+	free(m);
+}
+
+bool metrics_owns(const struct metrics *m, int fd) {
+	if (fd == m->fd) {
+		return true;
+	}
+	for (size_t i = 0; i < METRICS_CONNS; i++) {
+		if (m->conns[i] == fd) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void metrics_tick(struct metrics *m, uint64_t lines, uint64_t now) {
+	const uint64_t ns = nsec_since(now, m->window);
+	if (ns >= METRICS_RATE) {
+		m->rate = (lines - m->count) * NSEC_PER_SEC / ns;
+		m->window = now;
+		m->count = lines;
+		m->rated = true;
+	}
+}
+
+uint64_t metrics_due(const struct metrics *m) {
+	return m->window + METRICS_RATE;
+}
+
+/* Until the first window is over, the rate so far is all there is to go on */
+static uint64_t rate(const struct metrics *m, uint64_t lines, uint64_t now) {
+	const uint64_t ns = nsec_since(now, m->window);
+	if (!m->rated && ns) {
+		return lines * NSEC_PER_SEC / ns;
+	}
+	return m->rate;
+}
+
+/* A response being built up, which gets cut short rather than overflowing */
+struct response {
+	char *buf;
+	size_t len;
+};
+
+static __attribute__((format(printf, 2, 3)))
+void put(struct response *r, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	const int n = vsnprintf(r->buf + r->len, METRICS_MAX - r->len, fmt, args);
+	va_end(args);
+	if (n > 0) {
+		r->len += (size_t)n < METRICS_MAX - r->len ? (size_t)n : METRICS_MAX - r->len - 1;
+	}
+}
+
+/* Put a metric in nanoseconds as seconds, which is what Prometheus expects */
+static void seconds(struct response *r, const char *name, const char *labels, uint64_t ns) {
+	const struct timespec ts = timespec_from_nsec(ns);
+	put(r, "%s%s %lu.%09lu\n", name, labels, ts.tv_sec, ts.tv_nsec);
+}
+
+/* Write out every metric, as of the snapshot. Returns the length. */
+static size_t format(struct metrics *m, char buf[METRICS_MAX],
+                     const struct metrics_snapshot *snap, uint64_t now) {
+	static const struct {
+		const char *label;
+		double percent;
+	} quantiles[] = {
+		{ "{quantile=\"0.5\"}", 50.0 },
+		{ "{quantile=\"0.9\"}", 90.0 },
+		{ "{quantile=\"0.99\"}", 99.0 },
+	};
+	const struct histogram *h = snap->lat;
+	struct response r = { .buf = buf, .len = 0 };
+
+	metrics_tick(m, h->count, now);
+
+	put(&r, "# HELP tach_lines_total Lines that have finished.\n"
+	        "# TYPE tach_lines_total counter\n"
+	        "tach_lines_total %llu\n", (unsigned long long)h->count);
+	put(&r, "# HELP tach_lines_per_second Lines that finished over the last second.\n"
+	        "# TYPE tach_lines_per_second gauge\n"
+	        "tach_lines_per_second %llu\n", (unsigned long long)rate(m, h->count, now));
+
+	put(&r, "# HELP tach_runtime_seconds Time since the run started.\n"
+	        "# TYPE tach_runtime_seconds gauge\n");
+	seconds(&r, "tach_runtime_seconds", "", snap->runtime);
+	put(&r, "# HELP tach_line_age_seconds Time since the current line started.\n"
+	        "# TYPE tach_line_age_seconds gauge\n");
+	seconds(&r, "tach_line_age_seconds", "", snap->age);
+	put(&r, "# HELP tach_line_duration_max_seconds The longest that a line has taken.\n"
+	        "# TYPE tach_line_duration_max_seconds gauge\n");
+	seconds(&r, "tach_line_duration_max_seconds", "", h->count ? h->max : 0);
+
+	/* Percentiles are a walk over a fixed number of buckets, however many lines */
+	put(&r, "# HELP tach_line_duration_seconds How long lines have taken.\n"
+	        "# TYPE tach_line_duration_seconds summary\n");
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(*quantiles); i++) {
+		seconds(&r, "tach_line_duration_seconds", quantiles[i].label,
+		        hist_percentile(h, quantiles[i].percent));
+	}
+	seconds(&r, "tach_line_duration_seconds_sum", "", h->total);
+	put(&r, "tach_line_duration_seconds_count %llu\n", (unsigned long long)h->count);
+
+	return r.len;
+}
+
+/*
+ * Send the metrics, along with enough of an HTTP response for curl and
+ * Prometheus, whatever was asked for. It all fits in a socket buffer, and a
+ * client that isn't reading gets cut off rather than waited on.
+ */
+static void answer(struct metrics *m, int fd, const struct metrics_snapshot *snap,
+                   uint64_t now) {
+	static const char header[] = "HTTP/1.0 200 OK\r\n"
+	                             "Content-Type: text/plain; version=0.0.4\r\n"
+	                             "Connection: close\r\n\r\n";
+	char buf[sizeof(header) - 1 + METRICS_MAX];
+	memcpy(buf, header, sizeof(header) - 1);
+	const size_t len = sizeof(header) - 1 + format(m, buf + sizeof(header) - 1, snap, now);
+	send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+void metrics_serve(struct metrics *m, int fd, const struct metrics_snapshot *snap,
+                   uint64_t now) {
+	if (fd != m->fd) {
+		/* Any of the request, or the end of it, is enough to go on */
+		char request[512];
+		while (read(fd, request, sizeof(request)) > 0);
+		answer(m, fd, snap, now);
+
+		el_unwatch_fd(m->loop, fd);
+		close(fd);
+		for (size_t i = 0; i < METRICS_CONNS; i++) {
+			if (m->conns[i] == fd) {
+				m->conns[i] = -1;
+			}
+		}
+		return;
+	}
+
+	int conn;
+	while ((conn = accept(m->fd, NULL, NULL)) != -1) {
+		unblock(conn);
+#if defined(SO_NOSIGPIPE)
+		const int on = 1;
+		setsockopt(conn, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		/* Wait for the request, unless too many others already are */
+		size_t i = 0;
+		while (i < METRICS_CONNS && m->conns[i] != -1) {
+			i++;
+		}
+		if (i < METRICS_CONNS) {
+			m->conns[i] = conn;
+			el_watch_fd(m->loop, conn);
+		} else {
+			answer(m, conn, snap, now);
+			close(conn);
+		}
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+		warn("accept");
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct eventloop;
+struct histogram;
+
+/*
+ * Metrics are served in the Prometheus text format over a Unix domain socket,
+ * for watching a long run from outside of its terminal, such as with:
+ *
+ *   curl --unix-socket PATH http://localhost/metrics
+ *
+ * Every connection gets the metrics as of when its request arrives, in a single
+ * non-blocking write, and is closed right after, so a scraper can never hold
+ * up the event loop that serves it.
+ */
+struct metrics;
+
+/* What a scrape reports, as of now */
+struct metrics_snapshot {
+	/** Every finished line's duration, which the caller keeps up to date */
+	const struct histogram *lat;
+	/** The time since the run started, and since the current line did */
+	uint64_t runtime;
+	uint64_t age;
+};
+
+/*
+ * Listen on a new socket at path, replacing a stale one left behind there, and
+ * have the eventloop watch it and every connection to it.
+ */
+struct metrics *metrics_open(const char *path, struct eventloop *loop, uint64_t now);
+void metrics_close(struct metrics *m);
+
+/*
+ * Close out the window that the lines per second are counted over, if it has
+ * run its course, given how many lines have finished so far. This needs to be
+ * called as time goes by, whether or not anything is scraping.
+ */
+void metrics_tick(struct metrics *m, uint64_t lines, uint64_t now);
+
+/* When the current window is due to close */
+uint64_t metrics_due(const struct metrics *m);
+
+/* Whether a descriptor is the listening socket or one of its connections */
+bool metrics_owns(const struct metrics *m, int fd);
+
+/*
+ * Accept whoever is waiting, when fd is the listening socket, or answer a
+ * request that has come in on a connection.
+ */
+void metrics_serve(struct metrics *m, int fd, const struct metrics_snapshot *snap,
+                   uint64_t now);
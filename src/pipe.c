@@ -24,11 +24,21 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sysexits.h>
 #include <unistd.h>
 
+#include "event.h"
 #include "pipe.h"
 
+/* glibc hides this behind _GNU_SOURCE, but Linux has had it since 2.6.35 */
+#if defined(__linux__) && !defined(F_SETPIPE_SZ)
+#define F_SETPIPE_SZ 1031
+#endif
+
+/* How big a pipe being streamed in gets, so its writer rarely has to wait */
+#define STREAM_PIPE_SIZE (1024 * 1024)
+
 /*
  * mkpipe creates a descriptor pair where the 0 index is the output, and the 1
  * index is the input, ala pipe(2). Rather than hardcode these indices
@@ -81,7 +91,15 @@ static void cloexec(int fd) {
 	}
 }
 
-struct descendent spawn(char * const argv[], bool usepty) {
+static void nonblock(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		err(EX_OSERR, "fcntl");
+	}
+}
+
+struct descendent spawn(char * const argv[], bool usepty,
+                        const struct eventloop *loop) {
 	/* Setup stdout and stderr pipes */
 	int stdout_pair[2];
 	int stderr_pair[2];
@@ -114,6 +132,9 @@ struct descendent spawn(char * const argv[], bool usepty) {
 			become(stdout_pair, STDOUT_FILENO);
 			become(stderr_pair, STDERR_FILENO);
 
+			/* Signals that we watch shouldn't be kept from the command */
+			el_restore_signals(loop);
+
 			execvp(argv[0], argv);
 
 			/* exec failed */
@@ -147,5 +168,47 @@ struct descendent spawn(char * const argv[], bool usepty) {
 	close(stdout_pair[PIPE_IN]);
 	close(stderr_pair[PIPE_IN]);
 
+	/*
+	 * Nobody else shares the output sides, so they can be drained without
+	 * blocking, and shouldn't leak into any other children.
+	 */
+	for (int i = 0; i < 2; i++) {
+		const int fd = i ? result.err : result.out;
+		cloexec(fd);
+		nonblock(fd);
+	}
+
 	return result;
 }
+
+int attach(const char *source) {
+	/* A plain number is a descriptor that is already open */
+	char *end;
+	int fd = (int)strtol(source, &end, 10);
+	if (!*source || *end) {
+		/* Opening a FIFO waits for something to start writing to it */
+		if ((fd = open(source, O_RDONLY)) == -1) {
+			err(EX_NOINPUT, "%s", source);
+		}
+		cloexec(fd);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		err(EX_NOINPUT, "%s", source);
+	}
+
+	/*
+	 * Only a pipe can be safely switched to non-blocking, since a terminal
+	 * would stay that way for whoever uses it after us.
+	 */
+	if (S_ISFIFO(st.st_mode)) {
+		nonblock(fd);
+#ifdef F_SETPIPE_SZ
+		/* Not being allowed to grow it is no reason to stop */
+		fcntl(fd, F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+#endif
+	}
+
+	return fd;
+}
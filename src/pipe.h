@@ -23,6 +23,8 @@
 #include <stdbool.h>
 #include <unistd.h>
 
+struct eventloop;
+
 struct descendent {
 	pid_t pid;
 	int out;
@@ -31,6 +33,16 @@ struct descendent {
 
 /**
  * fork, exec, and connect the stdout and stderr of a specified child
- * executable, with specified arguments.
+ * executable, with specified arguments. The child gets signals the way it
+ * would have before the eventloop started watching them.
+ */
+struct descendent spawn(char * const argv[], bool usepty,
+                        const struct eventloop *loop);
+
+/**
+ * Open an existing source of output to time, instead of spawning a command.
+ * The source is either the number of a descriptor that is already open, or
+ * the path of a file or FIFO. Pipes are made non-blocking, and given a large
+ * buffer where possible, so that reading them can keep up with the writer.
  */
-struct descendent spawn(char * const argv[], bool usepty);
+int attach(const char *source);
@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "procs.h"
+#include "hash.h"
+#include "time.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+/*
+ * How often the tree is walked, at most. Every process in it costs a couple of
+ * reads from /proc, which is too much to pay for every line of a flood.
+ */
+#define PROCS_INTERVAL (10 * NSEC_PER_MSEC)
+
+/* Long enough for any command name, which the kernel cuts down to 15 bytes */
+#define PROCS_NAME     (16)
+
+/* The most leaf commands noted for a job at once */
+#define PROCS_RECENT   (4)
+
+/* Everything that ran under the same name */
+struct command {
+	char name[PROCS_NAME];
+	/** How long it was a leaf, counted once however many ran at once */
+	uint64_t total;
+	/** How many processes ran it, counting each exec */
+	unsigned long procs;
+	/** The last walk that found it as a leaf */
+	uint64_t walk;
+};
+
+struct proc {
+	pid_t pid;
+	/** Which job it belongs to, or -1 if that isn't known */
+	int job;
+	/** What it's running, which changes whenever it execs */
+	struct command *command;
+	/** The last walk that found any child of it */
+	uint64_t parent;
+};
+
+/* The leaf commands of a job, as of the last walk, and since they were asked */
+struct recent {
+	const struct command *now[PROCS_RECENT];
+	size_t nnow;
+	const struct command *since[PROCS_RECENT];
+	size_t nsince;
+};
+
+/* Each job's command, which is reaped by the event loop rather than here */
+struct root {
+	pid_t pid;
+	unsigned job;
+};
+
+struct procs {
+	struct root *roots;
+	size_t nroots;
+	struct recent *recent;
+	size_t njobs;
+
+	/**
+	 * The processes found by the last walk, hashed by pid, and the table
+	 * that the next walk fills in, which trade places once it's done.
+	 */
+	struct proc *table;
+	struct proc *next;
+	size_t size;
+	size_t count;
+
+	/** Every command seen so far, hashed by name */
+	struct command **commands;
+	size_t csize;
+	size_t ccount;
+
+	/** Processes still to be looked at, while walking the tree */
+	pid_t *pending;
+	size_t psize;
+
+	uint64_t walk;
+	uint64_t when;
+};
+
+static void grow_commands(struct procs *p) {
+	const size_t size = p->csize ? p->csize * 2 : 64;
+	struct command **table = calloc(size, sizeof(*table));
+	if (!table) {
+		err(EX_OSERR, "calloc");
+	}
+
+	for (size_t i = 0; i < p->csize; i++) {
+		struct command *c = p->commands[i];
+		if (!c) {
+			continue;
+		}
+		size_t slot = fnv(c->name, strlen(c->name)) & (size - 1);
+		while (table[slot]) {
+			slot = (slot + 1) & (size - 1);
+		}
+		table[slot] = c;
+	}
+
+	free(p->commands);
+	p->commands = table;
+	p->csize = size;
+}
+
+/* Find the command with a name, making it if it's new */
+static struct command *command(struct procs *p, const char *name, size_t len) {
+	if (len >= PROCS_NAME) {
+		len = PROCS_NAME - 1;
+	}
+
+	/* Keep the table under three quarters full, so probes stay short */
+	if ((p->ccount + 1) * 4 > p->csize * 3) {
+		grow_commands(p);
+	}
+
+	size_t slot = fnv(name, len) & (p->csize - 1);
+	for (struct command *c; (c = p->commands[slot]);
+	     slot = (slot + 1) & (p->csize - 1)) {
+		if (!strncmp(c->name, name, len) && !c->name[len]) {
+			return c;
+		}
+	}
+
+	struct command *c = calloc(1, sizeof(struct command));
+	if (!c) {
+		err(EX_OSERR, "calloc");
+	}
+	memcpy(c->name, name, len);
+	p->commands[slot] = c;
+	p->ccount++;
+	return c;
+}
+
+/* Find a process in a table, or the empty slot where it would go */
+static struct proc *find(struct proc *table, size_t size, pid_t pid) {
+	size_t slot = ((uint64_t)pid * 0x9e3779b97f4a7c15ULL >> 32) & (size - 1);
+	while (table[slot].pid && table[slot].pid != pid) {
+		slot = (slot + 1) & (size - 1);
+	}
+	return table + slot;
+}
+
+/* Make room in the table that's being filled in, keeping what's in both */
+static void grow_procs(struct procs *p) {
+	const size_t size = p->size * 2;
+	struct proc *table = calloc(size, sizeof(struct proc));
+	struct proc *next = calloc(size, sizeof(struct proc));
+	if (!table || !next) {
+		err(EX_OSERR, "calloc");
+	}
+
+	for (size_t i = 0; i < p->size; i++) {
+		if (p->table[i].pid) {
+			*find(table, size, p->table[i].pid) = p->table[i];
+		}
+		if (p->next[i].pid) {
+			*find(next, size, p->next[i].pid) = p->next[i];
+		}
+	}
+
+	free(p->table);
+	free(p->next);
+	p->table = table;
+	p->next = next;
+	p->size = size;
+}
+
+static void push(struct procs *p, size_t *n, pid_t pid) {
+	if (*n == p->psize) {
+		p->psize = p->psize ? p->psize * 2 : 64;
+		if (!(p->pending = realloc(p->pending, p->psize * sizeof(pid_t)))) {
+			err(EX_OSERR, "realloc");
+		}
+	}
+	p->pending[(*n)++] = pid;
+}
+
+/* Note a command in a short list, unless it's already there or the list is full */
+static void note(const struct command *list[PROCS_RECENT], size_t *n,
+                 const struct command *c) {
+	for (size_t i = 0; i < *n; i++) {
+		if (list[i] == c) {
+			return;
+		}
+	}
+	if (*n < PROCS_RECENT) {
+		list[(*n)++] = c;
+	}
+}
+
+#if defined(__linux__)
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+/* Enough for any stat file, or the children of all but the busiest */
+#define PROCS_BUF (16 * 1024)
+
+/* Read a whole file from /proc into buf, NULL terminated */
+static bool slurp(const char *path, char buf[PROCS_BUF]) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+
+	size_t len = 0;
+	ssize_t n;
+	while (len < PROCS_BUF - 1 && (n = read(fd, buf + len, PROCS_BUF - 1 - len)) > 0) {
+		len += (size_t)n;
+	}
+	close(fd);
+
+	buf[len] = '\0';
+	return len > 0;
+}
+
+/* Queue up every child listed in a children file */
+static void children(struct procs *p, size_t *n, const char *path, char buf[PROCS_BUF]) {
+	if (!slurp(path, buf)) {
+		return;
+	}
+	for (char *cur = buf, *end; *cur; cur = end) {
+		const long child = strtol(cur, &end, 10);
+		if (end == cur) {
+			break;
+		}
+		push(p, n, (pid_t)child);
+	}
+}
+
+static bool supported(void) {
+	return !prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+}
+
+static const struct root *root(const struct procs *p, pid_t pid) {
+	for (size_t i = 0; i < p->nroots; i++) {
+		if (p->roots[i].pid == pid) {
+			return p->roots + i;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find every process under this one, filling in the next table. Parents are
+ * always looked at before their children, so that a new process can be put in
+ * the same job as its parent.
+ */
+static void walk(struct procs *p) {
+	const pid_t self = getpid();
+	char path[64];
+	char buf[PROCS_BUF];
+
+	/* Any of this process's threads could have children, orphans included */
+	size_t n = 0;
+	snprintf(path, sizeof(path), "/proc/%d/task", (int)self);
+	DIR *tasks = opendir(path);
+	if (!tasks) {
+		return;
+	}
+	for (struct dirent *d; (d = readdir(tasks));) {
+		char *end;
+		const long tid = strtol(d->d_name, &end, 10);
+		if (end != d->d_name && !*end) {
+			snprintf(path, sizeof(path), "/proc/%d/task/%ld/children", (int)self, tid);
+			children(p, &n, path, buf);
+		}
+	}
+	closedir(tasks);
+
+	while (n) {
+		const pid_t pid = p->pending[--n];
+
+		/* The command name can have anything in it, so go from its end */
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+		char *name, *end;
+		if (!slurp(path, buf) || !(name = strchr(buf, '(')) ||
+		    !(end = strrchr(buf, ')')) || end[1] != ' ' || !end[2]) {
+			continue; /* Gone already */
+		}
+		const char state = end[2];
+		const pid_t ppid = (pid_t)strtol(end + 3, NULL, 10);
+		const struct root *r = root(p, pid);
+
+		/* Orphans that exited are reaped by the event loop */
+		if (state == 'Z') {
+			continue;
+		}
+
+		if ((p->count + 1) * 4 > p->size * 3) {
+			grow_procs(p);
+		}
+		struct proc *proc = find(p->next, p->size, pid);
+		if (proc->pid) {
+			continue; /* Found through more than one thread */
+		}
+		/* Taken first, so that a parent that's missing can't turn up here */
+		proc->pid = pid;
+		p->count++;
+
+		const struct proc *last = find(p->table, p->size, pid);
+		struct proc *parent = find(p->next, p->size, ppid);
+
+		proc->command = command(p, name + 1, (size_t)(end - name - 1));
+		if (r) {
+			proc->job = (int)r->job;
+		} else if (last->pid) {
+			proc->job = last->job;
+		} else {
+			proc->job = parent->pid ? parent->job : -1;
+		}
+		if (!last->pid || last->command != proc->command) {
+			proc->command->procs++;
+		}
+		if (parent->pid) {
+			parent->parent = p->walk;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, (int)pid);
+		children(p, &n, path, buf);
+	}
+}
+
+#else
+
+/* There's no /proc to walk */
+static bool supported(void) {
+	return false;
+}
+
+static void walk(struct procs *p) {
+	(void)p;
+}
+
+#endif
+
+struct procs *procs_open(uint64_t now) {
+	if (!supported()) {
+		return NULL;
+	}
+
+	struct procs *p = calloc(1, sizeof(struct procs));
+	if (!p) {
+		err(EX_OSERR, "calloc");
+	}
+	p->size = 256;
+	p->table = calloc(p->size, sizeof(struct proc));
+	p->next = calloc(p->size, sizeof(struct proc));
+	if (!p->table || !p->next) {
+		err(EX_OSERR, "calloc");
+	}
+	grow_commands(p);
+	p->when = now;
+	return p;
+}
+
+void procs_close(struct procs *p) {
+	for (size_t i = 0; i < p->csize; i++) {
+		free(p->commands[i]);
+	}
+	free(p->commands);
+	free(p->table);
+	free(p->next);
+	free(p->pending);
+	free(p->roots);
+	free(p->recent);
+	free(p);
+}
+
+void procs_watch(struct procs *p, pid_t pid, unsigned job) {
+	p->roots = realloc(p->roots, (p->nroots + 1) * sizeof(struct root));
+	if (!p->roots) {
+		err(EX_OSERR, "realloc");
+	}
+	p->roots[p->nroots++] = (struct root){ .pid = pid, .job = job };
+
+	if (job >= p->njobs) {
+		p->recent = realloc(p->recent, (job + 1) * sizeof(struct recent));
+		if (!p->recent) {
+			err(EX_OSERR, "realloc");
+		}
+		memset(p->recent + p->njobs, 0, (job + 1 - p->njobs) * sizeof(struct recent));
+		p->njobs = job + 1;
+	}
+}
+
+void procs_tick(struct procs *p, uint64_t now, bool force) {
+	const uint64_t wall = nsec_since(now, p->when);
+	if (!force && wall < PROCS_INTERVAL) {
+		return;
+	}
+
+	p->walk++;
+	p->count = 0;
+	memset(p->next, 0, p->size * sizeof(struct proc));
+	walk(p);
+
+	for (size_t i = 0; i < p->njobs; i++) {
+		p->recent[i].nnow = 0;
+	}
+
+	/* Whatever has no children left is a leaf, and gets the time since the last walk */
+	for (size_t i = 0; i < p->size; i++) {
+		const struct proc *proc = p->next + i;
+		if (!proc->pid || proc->parent == p->walk) {
+			continue;
+		}
+		struct command *c = proc->command;
+		if (c->walk != p->walk) {
+			c->walk = p->walk;
+			c->total += wall;
+		}
+		if (proc->job >= 0 && (size_t)proc->job < p->njobs) {
+			struct recent *r = p->recent + proc->job;
+			note(r->now, &r->nnow, c);
+			note(r->since, &r->nsince, c);
+		}
+	}
+
+	struct proc *last = p->table;
+	p->table = p->next;
+	p->next = last;
+	p->when = now;
+}
+
+uint64_t procs_due(const struct procs *p) {
+	return p->when + PROCS_INTERVAL;
+}
+
+size_t procs_leaves(struct procs *p, unsigned job, char *out, size_t size) {
+	if (job >= p->njobs || !size) {
+		return 0;
+	}
+
+	struct recent *r = p->recent + job;
+	const struct command **list = r->nsince ? r->since : r->now;
+	const size_t n = r->nsince ? r->nsince : r->nnow;
+
+	size_t len = 0;
+	for (size_t i = 0; i < n && len < size; i++) {
+		const size_t room = size - len;
+		const int wrote = snprintf(out + len, room, "%s%s", i ? "," : "", list[i]->name);
+		len += (size_t)wrote < room ? (size_t)wrote : room - 1;
+	}
+	for (size_t i = 0; i < len; i++) {
+		if (out[i] < ' ' || out[i] > '~') {
+			out[i] = '?';
+		}
+	}
+	r->nsince = 0;
+	return len;
+}
+
+static int longest(const void *a, const void *b) {
+	const struct command *x = *(const struct command * const *)a;
+	const struct command *y = *(const struct command * const *)b;
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+void procs_print(const struct procs *p, uint64_t elapsed, FILE *out) {
+	const struct command **all = malloc((p->ccount + 1) * sizeof(*all));
+	if (!all) {
+		err(EX_OSERR, "malloc");
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < p->csize; i++) {
+		if (p->commands[i] && p->commands[i]->total) {
+			all[n++] = p->commands[i];
+		}
+	}
+	qsort(all, n, sizeof(*all), longest);
+
+	for (size_t i = 0; i < n; i++) {
+		const struct timespec total = timespec_from_nsec(all[i]->total);
+		const double percent = elapsed ? 100.0 * all[i]->total / elapsed : 0.0;
+		fprintf(out, "%6lu.%06lu %5.1f%% %8lu procs  %s\n",
+		        total.tv_sec, total.tv_nsec / NSEC_PER_USEC, percent,
+		        all[i]->procs, all[i]->name);
+	}
+	free(all);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Follows every process that the jobs start, however deep, by walking the tree
+ * under this one in /proc every so often. It's the leaves of the tree that are
+ * doing the work, while everything above them, like make or a shell, is mostly
+ * waiting on them, so those are what get noted: the leaf commands that ran
+ * during each line, and how long each command spent as a leaf overall.
+ *
+ * This process becomes a subreaper, so that whatever a job's processes leave
+ * behind when they exit gets reparented here rather than to init, and stays in
+ * view. Those orphans have to be reaped, which the event loop does, given
+ * el_reap_all.
+ */
+struct procs;
+
+/* Become a subreaper, before any jobs start. Returns NULL if the system can't. */
+struct procs *procs_open(uint64_t now);
+void procs_close(struct procs *p);
+
+/* Follow a job's command, and everything it starts */
+void procs_watch(struct procs *p, pid_t pid, unsigned job);
+
+/* Walk the tree again, unless the last walk was too recent, and it isn't forced */
+void procs_tick(struct procs *p, uint64_t now, bool force);
+
+/* When the tree is next due to be walked, to keep up while nothing is said */
+uint64_t procs_due(const struct procs *p);
+
+/*
+ * Write the names of the leaf commands that a job ran since this was last
+ * asked, separated by commas, or the ones that are running if there were none,
+ * as many as fit. Anything unprintable in their names comes out as '?'. Returns
+ * the length, which is 0 if there aren't any.
+ */
+size_t procs_leaves(struct procs *p, unsigned job, char *out, size_t size);
+
+/* Break the time down by leaf command, longest first, against how long it all took */
+void procs_print(const struct procs *p, uint64_t elapsed, FILE *out);
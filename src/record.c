@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "record.h"
+#include "time.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/*
+ * How much gets buffered up before a chunk is written out. Either limit
+ * being reached triggers a write.
+ */
+#define REC_RECORDS (4096)
+#define REC_TEXT    (256 * 1024)
+
+/* Round up to the alignment that every chunk keeps */
+#define REC_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/* The line that a stream is in the middle of */
+struct rec_pending {
+	/** Its text so far, up to REC_LINE_TEXT */
+	char *text;
+	size_t len;
+	size_t size;
+	/** Its length so far, including whatever didn't fit */
+	uint64_t length;
+	/** The number of times it has wrapped. */
+	uint16_t wraps;
+};
+
+struct recorder {
+	int fd;
+	/** The number of bytes written to the file so far. */
+	uint64_t offset;
+	/** The line number of the next line. */
+	uint64_t index;
+
+	/** Finished lines that have not been written out yet. */
+	struct rec_line *records;
+	size_t count;
+
+	/** Text of the buffered lines. */
+	char *text;
+	size_t textlen;
+
+	/**
+	 * The current line of stdout and of stderr, which are kept apart until
+	 * they finish, since their rows can come in interleaved.
+	 */
+	struct rec_pending pending[2];
+};
+
+static struct rec_pending *pending(struct recorder *rec, enum rec_stream stream) {
+	return rec->pending + (stream == REC_STDERR);
+}
+
+static void writeall(struct recorder *rec, struct iovec *iov, int iovcnt) {
+	while (iovcnt) {
+		ssize_t written = writev(rec->fd, iov, iovcnt);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EX_IOERR, "write");
+		}
+		rec->offset += (uint64_t)written;
+
+		/* Skip past whatever made it out, in case it was a short write */
+		while (iovcnt && (size_t)written >= iov->iov_len) {
+			written -= (ssize_t)iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= (size_t)written;
+		}
+	}
+}
+
+/* Write out a chunk of every finished line */
+static void flush(struct recorder *rec) {
+	if (!rec->count) {
+		return;
+	}
+
+	const struct rec_chunk chunk = {
+		.count = rec->count,
+		.textlen = rec->textlen,
+	};
+
+	/* Turn the text offsets into file offsets, now that they are known */
+	const uint64_t base = rec->offset + sizeof(chunk) +
+	                      rec->count * sizeof(struct rec_line);
+	for (size_t i = 0; i < rec->count; i++) {
+		rec->records[i].text += base;
+	}
+
+	static const char padding[8];
+	struct iovec iov[] = {
+		{ .iov_base = (void *)&chunk, .iov_len = sizeof(chunk) },
+		{ .iov_base = rec->records, .iov_len = rec->count * sizeof(struct rec_line) },
+		{ .iov_base = rec->text, .iov_len = rec->textlen },
+		{ .iov_base = (void *)padding, .iov_len = REC_ALIGN(rec->textlen) - rec->textlen },
+	};
+	writeall(rec, iov, sizeof(iov) / sizeof(*iov));
+
+	rec->textlen = 0;
+	rec->count = 0;
+}
+
+struct recorder *rec_open(const char *path) {
+	struct recorder *rec = calloc(sizeof(struct recorder), 1);
+	if (!rec ||
+	    !(rec->records = malloc(REC_RECORDS * sizeof(struct rec_line))) ||
+	    !(rec->text = malloc(REC_TEXT))) {
+		err(EX_OSERR, "malloc");
+	}
+
+	if ((rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+		err(EX_CANTCREAT, "%s", path);
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	struct rec_header header = {
+		.magic = REC_MAGIC,
+		.version = REC_VERSION,
+		.recsize = sizeof(struct rec_line),
+		.realtime = timespec_nsec(&now),
+	};
+	struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+	writeall(rec, &iov, 1);
+
+	return rec;
+}
+
+void rec_close(struct recorder *rec, uint64_t total) {
+	flush(rec);
+
+	/* The header is the one thing that isn't append-only */
+	if (pwrite(rec->fd, &total, sizeof(total), offsetof(struct rec_header, total)) == -1) {
+		err(EX_IOERR, "pwrite");
+	}
+
+	if (close(rec->fd) == -1) {
+		err(EX_IOERR, "close");
+	}
+
+	for (size_t i = 0; i < sizeof(rec->pending) / sizeof(*rec->pending); i++) {
+		free(rec->pending[i].text);
+	}
+	free(rec->records);
+	free(rec->text);
+	free(rec);
+}
+
+void rec_text(struct recorder *rec, enum rec_stream stream,
+              const char *text, size_t len) {
+	struct rec_pending *p = pending(rec, stream);
+	p->length += len;
+
+	/* A line that never ends would otherwise take all of memory with it */
+	if (len > REC_LINE_TEXT - p->len) {
+		len = REC_LINE_TEXT - p->len;
+	}
+	if (p->len + len > p->size) {
+		if (!p->size) {
+			p->size = 256;
+		}
+		while (p->len + len > p->size) {
+			p->size *= 2;
+		}
+		if (!(p->text = realloc(p->text, p->size))) {
+			err(EX_OSERR, "realloc");
+		}
+	}
+
+	memcpy(p->text + p->len, text, len);
+	p->len += len;
+}
+
+void rec_wrap(struct recorder *rec, enum rec_stream stream) {
+	/* A line that never ends would otherwise count back up from zero */
+	struct rec_pending *p = pending(rec, stream);
+	if (p->wraps < UINT16_MAX) {
+		p->wraps++;
+	}
+}
+
+void rec_return(struct recorder *rec, enum rec_stream stream) {
+	struct rec_pending *p = pending(rec, stream);
+	p->len = 0;
+	p->length = 0;
+	p->wraps = 0;
+}
+
+void rec_line(struct recorder *rec, uint64_t start, uint64_t duration,
+              enum rec_stream stream) {
+	/* A line's text is capped well under REC_TEXT, so it always fits after */
+	struct rec_pending *p = pending(rec, stream);
+	if (rec->textlen + p->len > REC_TEXT) {
+		flush(rec);
+	}
+
+	struct rec_line *line = rec->records + rec->count++;
+	line->index = rec->index++;
+	line->start = start;
+	line->duration = duration;
+	line->text = rec->textlen;
+	line->length = p->length < UINT32_MAX ? (uint32_t)p->length : UINT32_MAX;
+	line->wraps = p->wraps;
+	line->stream = (uint8_t)stream;
+	line->reserved = 0;
+
+	memcpy(rec->text + rec->textlen, p->text, p->len);
+	rec->textlen += p->len;
+	p->len = 0;
+	p->length = 0;
+	p->wraps = 0;
+
+	if (rec->count == REC_RECORDS) {
+		flush(rec);
+	}
+}
+
+struct recording *rec_map(const char *path) {
+	const int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		err(EX_NOINPUT, "%s", path);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		err(EX_IOERR, "%s", path);
+	}
+
+	struct recording *r = calloc(sizeof(struct recording), 1);
+	if (!r) {
+		err(EX_OSERR, "calloc");
+	}
+	r->path = path;
+	r->size = (size_t)st.st_size;
+
+	if (r->size < sizeof(struct rec_header)) {
+		errx(EX_DATAERR, "%s: Not a tach recording", path);
+	}
+
+	r->base = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (r->base == MAP_FAILED) {
+		err(EX_OSERR, "mmap");
+	}
+	close(fd);
+
+	/* Recordings are almost always read from front to back, exactly once */
+	madvise((void *)r->base, r->size, MADV_SEQUENTIAL);
+
+	r->header = (const struct rec_header *)r->base;
+	if (memcmp(r->header->magic, REC_MAGIC, sizeof(REC_MAGIC))) {
+		errx(EX_DATAERR, "%s: Not a tach recording", path);
+	}
+	if (r->header->version != REC_VERSION ||
+	    r->header->recsize != sizeof(struct rec_line)) {
+		errx(EX_DATAERR, "%s: Unsupported recording version %u", path,
+		     r->header->version);
+	}
+
+	return r;
+}
+
+void rec_unmap(struct recording *r) {
+	munmap((void *)r->base, r->size);
+	free(r);
+}
+
+bool rec_chunk(const struct recording *r, size_t *cursor,
+               const struct rec_line **lines, size_t *count) {
+	if (*cursor < sizeof(struct rec_header)) {
+		*cursor = sizeof(struct rec_header);
+	}
+
+	/* Stop at the end, or at a chunk that was cut short */
+	const size_t left = r->size - *cursor;
+	if (left < sizeof(struct rec_chunk)) {
+		return false;
+	}
+
+	const struct rec_chunk *chunk = (const struct rec_chunk *)(r->base + *cursor);
+	const size_t body = left - sizeof(*chunk);
+	if (chunk->count > body / sizeof(struct rec_line)) {
+		return false;
+	}
+
+	const size_t records = sizeof(struct rec_line) * chunk->count;
+	if (chunk->textlen > body - records ||
+	    REC_ALIGN(chunk->textlen) > body - records) {
+		return false;
+	}
+
+	/* Every line's text must be within the chunk's, to be used in place */
+	const uint64_t text = *cursor + sizeof(*chunk) + records;
+	const struct rec_line *line = (const struct rec_line *)(chunk + 1);
+	for (size_t i = 0; i < chunk->count; i++, line++) {
+		if (line->text < text || line->text - text > chunk->textlen ||
+		    rec_textlen(line) > chunk->textlen - (line->text - text)) {
+			errx(EX_DATAERR, "%s: Line %llu is out of bounds", r->path,
+			     (unsigned long long)line->index);
+		}
+	}
+
+	*lines = (const struct rec_line *)(chunk + 1);
+	*count = chunk->count;
+	*cursor += sizeof(*chunk) + records + REC_ALIGN(chunk->textlen);
+	return true;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * A recording is an append-only binary log of every line's timing. It is laid
+ * out so that a reader can mmap(2) it and walk millions of lines in place:
+ *
+ *   struct rec_header
+ *   struct rec_chunk, followed by rec_chunk.count struct rec_line records,
+ *                     followed by rec_chunk.textlen bytes of line text
+ *   struct rec_chunk ...
+ *
+ * Everything is in the native byte order of the machine that recorded it, and
+ * every structure is a multiple of 8 bytes, as is each chunk's text, so all of
+ * the records stay aligned. Line text is not NULL terminated.
+ */
+
+#define REC_MAGIC    "TACHLOG"
+#define REC_VERSION  (2)
+
+/* The most of a line's text that is kept, past which only its length is */
+#define REC_LINE_TEXT (64 * 1024)
+
+struct rec_header {
+	/** REC_MAGIC, NULL terminated */
+	char magic[8];
+	uint32_t version;
+	/** sizeof(struct rec_line), to catch mismatched readers */
+	uint32_t recsize;
+	/** Wall clock time that the run started, in nanoseconds since the epoch */
+	uint64_t realtime;
+	/** The total runtime in nanoseconds, filled in when the run finishes */
+	uint64_t total;
+};
+
+enum rec_stream {
+	REC_STDOUT = 1,
+	REC_STDERR = 2,
+};
+
+struct rec_chunk {
+	/** The number of records immediately following this chunk header */
+	uint64_t count;
+	/** The number of bytes of text following the records, before padding */
+	uint64_t textlen;
+};
+
+struct rec_line {
+	/** The line number, counting from 0 */
+	uint64_t index;
+	/** When the line started, in nanoseconds since the run started */
+	uint64_t start;
+	/** How long the line took, in nanoseconds */
+	uint64_t duration;
+	/** The file offset of the line's text, as much of it as was kept */
+	uint64_t text;
+	/** The length of the whole line, in bytes, up to UINT32_MAX */
+	uint32_t length;
+	/** How many times the line wrapped on screen, up to UINT16_MAX */
+	uint16_t wraps;
+	/** An enum rec_stream, for the stream that finished the line */
+	uint8_t stream;
+	uint8_t reserved;
+};
+
+struct recorder;
+
+struct recorder *rec_open(const char *path);
+
+/* Flush everything out, and note the total runtime in the header. */
+void rec_close(struct recorder *rec, uint64_t total);
+
+/*
+ * Each stream builds up its own current line, since stdout and stderr can
+ * take turns in the middle of one.
+ */
+
+/* Append text to the line that a stream is currently building. */
+void rec_text(struct recorder *rec, enum rec_stream stream,
+              const char *text, size_t len);
+
+/* A stream's current line wrapped on screen. */
+void rec_wrap(struct recorder *rec, enum rec_stream stream);
+
+/* A carriage return overwrote a stream's current line, so forget its text. */
+void rec_return(struct recorder *rec, enum rec_stream stream);
+
+/*
+ * Finish a stream's current line, recording when it started relative to the
+ * start of the run, and how long it took, in nanoseconds.
+ */
+void rec_line(struct recorder *rec, uint64_t start, uint64_t duration,
+              enum rec_stream stream);
+
+/* A read-only view of a whole recording, mapped into memory. */
+struct recording {
+	/** As given to rec_map, for errors */
+	const char *path;
+	const char *base;
+	size_t size;
+	const struct rec_header *header;
+};
+
+/* Map a recording, exiting with an error if it isn't one. */
+struct recording *rec_map(const char *path);
+void rec_unmap(struct recording *r);
+
+/*
+ * Walk the chunks of a recording, starting with a cursor of 0. Each call
+ * points lines at the next chunk's records. Returns false at the end of the
+ * recording, including if the last chunk was never completely written, and
+ * exits with an error if any line's text lies outside of its chunk.
+ */
+bool rec_chunk(const struct recording *r, size_t *cursor,
+               const struct rec_line **lines, size_t *count);
+
+static inline const char *rec_linetext(const struct recording *r,
+                                       const struct rec_line *line) {
+	return r->base + line->text;
+}
+
+/* How much of a line's text was kept, which is the start of it */
+static inline size_t rec_textlen(const struct rec_line *line) {
+	return line->length < REC_LINE_TEXT ? line->length : REC_LINE_TEXT;
+}
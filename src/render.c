@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "render.h"
+#include "time.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/* The initial frame size, which is plenty for a full terminal line or two */
+#define RB_MINSIZE (4096)
+
+struct renderbuf *rb_create(int fd) {
+	struct renderbuf *rb = calloc(sizeof(struct renderbuf), 1);
+	if (!rb || !(rb->buf = malloc(RB_MINSIZE))) {
+		err(EX_OSERR, "malloc");
+	}
+
+	rb->size = RB_MINSIZE;
+	rb->fd = fd;
+	return rb;
+}
+
+void rb_destroy(struct renderbuf *rb) {
+	free(rb->buf);
+	free(rb);
+}
+
+/* Make sure there is room for len more bytes in the frame */
+static char *reserve(struct renderbuf *rb, size_t len) {
+	if (rb->len + len > rb->size) {
+		size_t size = rb->size;
+		while (rb->len + len > size) {
+			size *= 2;
+		}
+
+		if (!(rb->buf = realloc(rb->buf, size))) {
+			err(EX_OSERR, "realloc");
+		}
+		rb->size = size;
+	}
+
+	return rb->buf + rb->len;
+}
+
+void rb_append(struct renderbuf *rb, const void *data, size_t len) {
+	memcpy(reserve(rb, len), data, len);
+	rb->len += len;
+}
+
+void rb_pad(struct renderbuf *rb, char c, size_t len) {
+	memset(reserve(rb, len), c, len);
+	rb->len += len;
+}
+
+size_t rb_timestamp_format(char buf[TS_MAX], uint64_t ns) {
+	/*
+	 * Fill the digits in from the right. Runs longer than the seconds field
+	 * push the timestamp wider, exactly like printf would.
+	 */
+	char digits[TS_MAX];
+	char *cur = digits + sizeof(digits);
+
+	unsigned long ms = (unsigned long)(ns % NSEC_PER_SEC / NSEC_PER_MSEC);
+	for (int i = 0; i < 3; i++) {
+		*--cur = (char)('0' + ms % 10);
+		ms /= 10;
+	}
+	*--cur = '.';
+
+	uint64_t sec = ns / NSEC_PER_SEC;
+	do {
+		*--cur = (char)('0' + sec % 10);
+		sec /= 10;
+	} while (sec);
+
+	const size_t len = (size_t)(digits + sizeof(digits) - cur);
+	const size_t pad = len < TS_WIDTH ? TS_WIDTH - len : 0;
+	memset(buf, ' ', pad);
+	memcpy(buf + pad, cur, len);
+	return pad + len;
+}
+
+void rb_timestamp(struct renderbuf *rb, uint64_t ns) {
+	const size_t len = rb_timestamp_format(reserve(rb, TS_MAX), ns);
+	rb->len += len;
+}
+
+void rb_forward(struct renderbuf *rb, size_t cols) {
+	if (!cols) {
+		return;
+	}
+
+	/* CUF, with the count filled in from the right */
+	char seq[TS_MAX];
+	char *cur = seq + sizeof(seq);
+	*--cur = 'C';
+	do {
+		*--cur = (char)('0' + cols % 10);
+		cols /= 10;
+	} while (cols);
+	*--cur = '[';
+	*--cur = '\x1b';
+	rb_append(rb, cur, (size_t)(seq + sizeof(seq) - cur));
+}
+
+void rb_flush(struct renderbuf *rb) {
+	const char *cur = rb->buf;
+	size_t left = rb->len;
+
+	while (left) {
+		const ssize_t written = write(rb->fd, cur, left);
+		rb->writes++;
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EX_IOERR, "write");
+		}
+		rb->written += (uint64_t)written;
+
+		cur += written;
+		left -= (size_t)written;
+	}
+
+	rb->len = 0;
+}
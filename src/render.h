@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 8 digits on the left-hand-side will allow for a process
+ * spanning ~3.17 years of runtime to not have problems
+ * with running out of timestamp columns.
+ */
+#define TS_SEC_WIDTH  (8)
+#define TS_WIDTH      (TS_SEC_WIDTH + 1 + 3) /* sec + '.' + msec */
+
+/* Room for the widest timestamp that a 64-bit count of nanoseconds can make */
+#define TS_MAX        (32)
+
+/*
+ * A renderbuf accumulates everything drawn in response to a single wakeup,
+ * so that the whole frame reaches the terminal with a single write(2).
+ */
+struct renderbuf {
+	char *buf;
+	/** The number of bytes waiting to be written. */
+	size_t len;
+	/** The allocated size of buf. */
+	size_t size;
+	/** The destination descriptor. */
+	int fd;
+
+	/** Calls to write(2) so far, and how many bytes they wrote. */
+	uint64_t writes;
+	uint64_t written;
+};
+
+struct renderbuf *rb_create(int fd);
+void rb_destroy(struct renderbuf *rb);
+
+void rb_append(struct renderbuf *rb, const void *data, size_t len);
+void rb_pad(struct renderbuf *rb, char c, size_t len);
+
+/* Like printf(3)'s "%8ld.%03ld" of seconds and milliseconds, but cheaper. */
+void rb_timestamp(struct renderbuf *rb, uint64_t ns);
+
+/* Format a timestamp exactly as rb_timestamp draws it, returning its length. */
+size_t rb_timestamp_format(char buf[TS_MAX], uint64_t ns);
+
+/* Move the cursor right by some number of columns, without drawing over them. */
+void rb_forward(struct renderbuf *rb, size_t cols);
+
+/* Write out everything that has accumulated, then start a new frame. */
+void rb_flush(struct renderbuf *rb);
+
+static inline void rb_puts(struct renderbuf *rb, const char *str) {
+	rb_append(rb, str, strlen(str));
+}
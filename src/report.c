@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "report.h"
+#include "histogram.h"
+#include "record.h"
+#include "time.h"
+#include "topn.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/* The default number of slowest lines to list */
+#define REPORT_SLOWEST (10)
+
+/* Per-stream totals */
+struct split {
+	const char *name;
+	uint64_t lines;
+	uint64_t time;
+};
+
+/* Print a duration the same way that the live summary does */
+static void duration(const char *label, uint64_t ns) {
+	const struct timespec ts = timespec_from_nsec(ns);
+	printf("%-7s%6lu.%06lu", label, ts.tv_sec, ts.tv_nsec / NSEC_PER_USEC);
+}
+
+static __attribute__((noreturn)) void usage(const char *progname) {
+	errx(EX_USAGE, "usage: %s report [-n count] file", progname);
+}
+
+int report(const char *progname, int argc, char * const argv[]) {
+	unsigned long count = REPORT_SLOWEST;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+			case 'n': {
+				char *end;
+				count = strtoul(optarg, &end, 10);
+				if (!*optarg || *end) {
+					usage(progname);
+				}
+			} break;
+			default: {
+				usage(progname);
+			} break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1) {
+		usage(progname);
+	}
+
+	struct recording *r = rec_map(argv[0]);
+
+	struct histogram *hist = malloc(sizeof(struct histogram));
+	if (!hist) {
+		err(EX_OSERR, "malloc");
+	}
+	hist_init(hist);
+
+	/* The text stays mapped until the end, so only the slowest get pointed to */
+	struct topn slowest;
+	topn_init(&slowest, count, 0);
+
+	struct split streams[] = {
+		{ .name = "stdout:" },
+		{ .name = "stderr:" },
+	};
+
+	/* The single pass over every line */
+	uint64_t end = 0;
+	size_t cursor = 0;
+	const struct rec_line *lines;
+	size_t n;
+	while (rec_chunk(r, &cursor, &lines, &n)) {
+		for (size_t i = 0; i < n; i++) {
+			const struct rec_line *line = lines + i;
+			hist_add(hist, line->duration);
+			if (topn_beats(&slowest, line->duration, 0)) {
+				topn_add(&slowest, line->duration, 0, line->index,
+				         line->stream == REC_STDERR, rec_linetext(r, line),
+				         rec_textlen(line));
+			}
+
+			struct split *stream = streams + (line->stream == REC_STDERR);
+			stream->lines++;
+			stream->time += line->duration;
+
+			end = line->start + line->duration;
+		}
+	}
+
+	/* A run that never finished only goes as far as its last line */
+	const uint64_t total = r->header->total ? r->header->total : end;
+	duration("Total:", total);
+	printf(" across %llu lines\n", (unsigned long long)hist->count);
+	duration("Max:", hist->count ? hist->max : 0);
+	printf("\n");
+
+	hist_print_percentiles(hist, stdout);
+
+	printf("\n");
+	for (size_t i = 0; i < sizeof(streams) / sizeof(*streams); i++) {
+		duration(streams[i].name, streams[i].time);
+		printf(" across %llu lines (%.1f%%)\n",
+		       (unsigned long long)streams[i].lines,
+		       hist->total ? 100.0 * (double)streams[i].time / (double)hist->total : 0.0);
+	}
+
+	printf("\nDistribution:\n");
+	hist_print(hist, stdout);
+
+	if (slowest.len) {
+		printf("\nSlowest lines:\n");
+		topn_print(&slowest, stdout);
+	}
+
+	topn_destroy(&slowest);
+	free(hist);
+	rec_unmap(r);
+	return EX_OK;
+}
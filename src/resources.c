@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "resources.h"
+#include "time.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+/*
+ * How often samples are taken, at most. Every process in the tree costs a few
+ * reads from /proc, which is too much to pay for every line of a flood, and
+ * any line that takes this long gets a sample of its own anyway.
+ */
+#define RES_INTERVAL (10 * NSEC_PER_MSEC)
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Enough for any stat or io file, or the children of all but the busiest */
+#define RES_BUF (16 * 1024)
+
+/* Read a whole file from /proc into buf, NULL terminated */
+static bool slurp(const char *path, char buf[RES_BUF]) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+
+	size_t len = 0;
+	ssize_t n;
+	while (len < RES_BUF - 1 && (n = read(fd, buf + len, RES_BUF - 1 - len)) > 0) {
+		len += (size_t)n;
+	}
+	close(fd);
+
+	buf[len] = '\0';
+	return len > 0;
+}
+
+/* Find the value of a "name: value" line in /proc/<pid>/io */
+static uint64_t field(const char *buf, const char *name) {
+	const char *line = strstr(buf, name);
+	return line ? strtoull(line + strlen(name), NULL, 10) : 0;
+}
+
+static void push(struct resources *r, size_t *n, pid_t pid) {
+	if (*n == r->size) {
+		r->size = r->size ? r->size * 2 : 64;
+		if (!(r->pending = realloc(r->pending, r->size * sizeof(pid_t)))) {
+			err(EX_OSERR, "realloc");
+		}
+	}
+	r->pending[(*n)++] = pid;
+}
+
+/* Add up every process in the tree. Returns false if the root is gone. */
+static bool sample(struct resources *r, struct res_sample *s) {
+	static long tick, page;
+	if (!tick) {
+		tick = sysconf(_SC_CLK_TCK);
+		page = sysconf(_SC_PAGESIZE);
+	}
+
+	memset(s, 0, sizeof(*s));
+	char path[64];
+	char buf[RES_BUF];
+	bool found = false;
+
+	size_t n = 0;
+	push(r, &n, r->pid);
+	while (n) {
+		const pid_t pid = r->pending[--n];
+
+		/* The command name can have anything in it, so go from its end */
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+		char *stat;
+		if (!slurp(path, buf) || !(stat = strrchr(buf, ')'))) {
+			continue; /* Gone already */
+		}
+		found = true;
+
+		/* utime, stime, cutime and cstime are fields 14-17, and rss 24 */
+		unsigned long long ticks = 0, rss = 0;
+		stat++;
+		for (int f = 3; f <= 24 && (stat = strchr(stat, ' ')); f++) {
+			const unsigned long long value = strtoull(++stat, NULL, 10);
+			if (f >= 14 && f <= 17) {
+				ticks += value;
+			} else if (f == 24) {
+				rss = value;
+			}
+		}
+		s->cpu += ticks * NSEC_PER_SEC / (uint64_t)tick;
+		s->rss += rss * (uint64_t)page;
+
+		snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+		if (slurp(path, buf)) {
+			s->read += field(buf, "read_bytes:");
+			s->written += field(buf, "\nwrite_bytes:");
+		}
+
+		/* Children started by its other threads are missed, but that's rare */
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, (int)pid);
+		if (slurp(path, buf)) {
+			for (char *cur = buf, *end; *cur; cur = end) {
+				const long child = strtol(cur, &end, 10);
+				if (end == cur) {
+					break;
+				}
+				push(r, &n, (pid_t)child);
+			}
+		}
+	}
+	return found;
+}
+
+#else
+
+/* There's no /proc to ask */
+static bool sample(struct resources *r, struct res_sample *s) {
+	(void)r;
+	(void)s;
+	return false;
+}
+
+#endif
+
+bool res_init(struct resources *r, pid_t pid, uint64_t now) {
+	memset(r, 0, sizeof(*r));
+	r->pid = pid;
+	r->when = now;
+	if (!sample(r, &r->last)) {
+		return false;
+	}
+	r->peak = r->last.rss;
+	return true;
+}
+
+void res_destroy(struct resources *r) {
+	free(r->pending);
+}
+
+/* Account for however much a total went up, if it did */
+static void grew(uint64_t *total, uint64_t was, uint64_t is) {
+	/* Processes that left the tree without being waited on take theirs along */
+	if (is > was) {
+		*total += is - was;
+	}
+}
+
+int res_tick(struct resources *r, uint64_t now, bool force) {
+	const uint64_t wall = nsec_since(now, r->when);
+	if (!force && wall < RES_INTERVAL) {
+		return -1;
+	}
+
+	struct res_sample s;
+	if (!sample(r, &s)) {
+		return -1;
+	}
+
+	grew(&r->cpu, r->last.cpu, s.cpu);
+	grew(&r->read, r->last.read, s.read);
+	grew(&r->written, r->last.written, s.written);
+	if (s.rss > r->peak) {
+		r->peak = s.rss;
+	}
+
+	const uint64_t cpu = s.cpu > r->last.cpu ? s.cpu - r->last.cpu : 0;
+	r->last = s;
+	r->when = now;
+	return wall ? (int)(cpu * 100 / wall) : 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * What a child and everything it started have used up, as of a sample. Only
+ * processes that are still around can be asked, but each one's counts include
+ * those of the children it has already waited on, so nothing is counted twice
+ * as processes come and go, and short-lived ones aren't missed.
+ */
+struct res_sample {
+	/** User and system time, in nanoseconds */
+	uint64_t cpu;
+	/** Bytes read from and written to storage */
+	uint64_t read;
+	uint64_t written;
+	/** Resident memory, in bytes, which rises and falls rather than adds up */
+	uint64_t rss;
+};
+
+/*
+ * Keeps track of a child's resource usage by sampling it at most every so
+ * often, and only ever looking at how much it went up since the last sample.
+ */
+struct resources {
+	pid_t pid;
+	/** The last sample, and when it was taken */
+	struct res_sample last;
+	uint64_t when;
+	/** What went up across every sample, and the most memory seen at once */
+	uint64_t cpu;
+	uint64_t read;
+	uint64_t written;
+	uint64_t peak;
+	/** Processes still to be looked at, while walking the tree */
+	pid_t *pending;
+	size_t size;
+};
+
+/* Take a first sample. Returns false if the system can't say. */
+bool res_init(struct resources *r, pid_t pid, uint64_t now);
+void res_destroy(struct resources *r);
+
+/*
+ * Sample again, unless the last sample was too recent to be worth it, and it
+ * wasn't forced. Returns the CPU time used since the last sample as a
+ * percentage of the time that passed, or -1 if no sample was taken.
+ */
+int res_tick(struct resources *r, uint64_t now, bool force);
@@ -22,29 +22,144 @@
 
 #include "time.h"
 
-#include <assert.h>
+#include <err.h>
+#include <string.h>
+#include <sysexits.h>
 
-bool timespec_compare(const struct timespec *a, const struct timespec *b) {
-	return (a->tv_sec > b->tv_sec) ||
-	       (a->tv_sec == b->tv_sec && a->tv_nsec >= b->tv_nsec);
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/* How long the TSC gets watched for, to work out its frequency */
+#define TSC_CALIBRATION (10 * NSEC_PER_MSEC)
+
+static const struct {
+	const char *name;
+	enum clk_source source;
+} names[] = {
+	{ "monotonic", CLK_MONOTONIC },
+	{ "raw",       CLK_MONOTONIC_RAW },
+	{ "boottime",  CLK_BOOTTIME },
+	{ "tsc",       CLK_TSC },
+};
+
+static struct {
+	enum clk_source source;
+	clockid_t id;
+
+	/*
+	 * TSC ticks are converted by ns = base + ticks * mult / 2^32, where ticks
+	 * are counted from the TSC's value at base.
+	 */
+	uint64_t base;
+	uint64_t tsc;
+	uint64_t mult;
+} clk = {
+	.source = CLK_MONOTONIC,
+	.id = CLOCK_MONOTONIC,
+};
+
+static uint64_t gettime(clockid_t id) {
+	struct timespec ts;
+	if (clock_gettime(id, &ts) == -1) {
+		err(EX_OSERR, "clock_gettime");
+	}
+	return timespec_nsec(&ts);
+}
+
+/* Switch to a clock, if the kernel actually has it */
+static bool use(enum clk_source source, clockid_t id) {
+	struct timespec ts;
+	if (clock_gettime(id, &ts) != 0) {
+		return false;
+	}
+	clk.source = source;
+	clk.id = id;
+	return true;
 }
 
-struct timespec timespec_subtract(const struct timespec *minuend,
-                                  const struct timespec *subtrahend) {
-	assert(timespec_compare(minuend, subtrahend));
+#ifdef HAVE_TSC
+static bool tsc_calibrate(void) {
+	/* Without an invariant TSC, the rate changes along with the CPU's */
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+		return false;
+	}
+
+	const uint64_t ns0 = gettime(CLOCK_MONOTONIC);
+	const uint64_t tsc0 = __rdtsc();
+
+	const struct timespec wait = timespec_from_nsec(TSC_CALIBRATION);
+	nanosleep(&wait, NULL);
+
+	const uint64_t ns1 = gettime(CLOCK_MONOTONIC);
+	const uint64_t tsc1 = __rdtsc();
 
 	/*
-	 * Borrow from the seconds place.
-	 *
-	 * tv_nsec is a long, and so should be capable of holding a spare
-	 * second (in nanoseconds) on all platforms.
+	 * Keeping mult under 2^32 means the conversion can't overflow, which
+	 * rules out a TSC slower than 1 GHz, but nothing with one is that slow.
 	 */
-	const int borrow = minuend->tv_nsec < subtrahend->tv_nsec;
+	const uint64_t ticks = tsc1 - tsc0;
+	if (tsc1 <= tsc0 || ticks <= ns1 - ns0) {
+		return false;
+	}
+
+	clk.mult = ((ns1 - ns0) << 32) / ticks;
+	clk.base = ns1;
+	clk.tsc = tsc1;
+	return true;
+}
+#endif
+
+bool clk_select(const char *name) {
+	size_t i;
+	for (i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (!strcmp(name, names[i].name)) {
+			break;
+		}
+	}
+	if (i == sizeof(names) / sizeof(*names)) {
+		return false;
+	}
 
-	const struct timespec result = {
-		.tv_sec = minuend->tv_sec - borrow - subtrahend->tv_sec,
-		.tv_nsec = minuend->tv_nsec + (borrow * NSEC_PER_SEC) - subtrahend->tv_nsec,
-	};
+	switch (names[i].source) {
+		case CLK_MONOTONIC: {
+			return use(CLK_MONOTONIC, CLOCK_MONOTONIC);
+		} break;
+		case CLK_MONOTONIC_RAW: {
+#ifdef CLOCK_MONOTONIC_RAW
+			return use(CLK_MONOTONIC_RAW, CLOCK_MONOTONIC_RAW);
+#endif
+		} break;
+		case CLK_BOOTTIME: {
+#ifdef CLOCK_BOOTTIME
+			return use(CLK_BOOTTIME, CLOCK_BOOTTIME);
+#endif
+		} break;
+		case CLK_TSC: {
+#ifdef HAVE_TSC
+			if (tsc_calibrate()) {
+				clk.source = CLK_TSC;
+				clk.id = CLOCK_MONOTONIC;
+				return true;
+			}
+#endif
+		} break;
+	}
+
+	return false;
+}
 
-	return result;
+uint64_t clk_now(void) {
+#ifdef HAVE_TSC
+	if (clk.source == CLK_TSC) {
+		/* Split the multiplication, so that neither half can overflow */
+		const uint64_t ticks = nsec_since(__rdtsc(), clk.tsc);
+		return clk.base + (ticks >> 32) * clk.mult +
+		       (((ticks & 0xffffffff) * clk.mult) >> 32);
+	}
+#endif
+	return gettime(clk.id);
 }
@@ -21,19 +21,57 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #define NSEC_PER_USEC (1000L)
 #define NSEC_PER_MSEC (1000000L)
 #define NSEC_PER_SEC  (1000000000L)
 
-/* Returns true if a >= b, otherwise false. */
-bool timespec_compare(const struct timespec *a, const struct timespec *b);
+/*
+ * Every timestamp is a count of nanoseconds from the selected clock, which is
+ * enough for a run of ~584 years, and means that durations are a subtraction
+ * away, rather than a borrow from the seconds place.
+ */
+enum clk_source {
+	/** CLOCK_MONOTONIC, which is slewed by NTP */
+	CLK_MONOTONIC,
+	/** CLOCK_MONOTONIC_RAW, which isn't */
+	CLK_MONOTONIC_RAW,
+	/** CLOCK_BOOTTIME, which also counts time spent suspended */
+	CLK_BOOTTIME,
+	/** The invariant TSC, calibrated against CLOCK_MONOTONIC */
+	CLK_TSC,
+};
 
 /*
- * minuend - subtrahend = result
- *
- * The minuend must be larger than the subtrahend.
+ * Select a clock by name, one of "monotonic", "raw", "boottime" or "tsc".
+ * Returns false for any other name, or for a clock that this system can't
+ * provide, leaving the clock as it was. This must be called before any other
+ * threads are started, if at all.
  */
-struct timespec timespec_subtract(const struct timespec *minuend,
-                                  const struct timespec *subtrahend);
+bool clk_select(const char *name);
+
+/* The current time, in nanoseconds */
+uint64_t clk_now(void);
+
+/*
+ * later - earlier, or 0 if they're the wrong way around. Timestamps taken on
+ * different threads can be off by a hair, and that shouldn't ever wrap around.
+ */
+static inline uint64_t nsec_since(uint64_t later, uint64_t earlier) {
+	return later > earlier ? later - earlier : 0;
+}
+
+/* The whole timespec, in nanoseconds */
+static inline uint64_t timespec_nsec(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+static inline struct timespec timespec_from_nsec(uint64_t ns) {
+	const struct timespec result = {
+		.tv_sec = (time_t)(ns / NSEC_PER_SEC),
+		.tv_nsec = (long)(ns % NSEC_PER_SEC),
+	};
+	return result;
+}
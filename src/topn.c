@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "topn.h"
+#include "time.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+void topn_init(struct topn *t, size_t size, size_t slot) {
+	t->len = 0;
+	t->size = size;
+	t->slot = slot;
+	t->lines = calloc(size ? size : 1, sizeof(struct topn_line));
+	t->arena = slot ? malloc(size * slot) : NULL;
+	if (!t->lines || (slot && size && !t->arena)) {
+		err(EX_OSERR, "malloc");
+	}
+}
+
+void topn_destroy(struct topn *t) {
+	free(t->lines);
+	free(t->arena);
+}
+
+/* The ranking of a line */
+static uint64_t excess(const struct topn_line *line) {
+	return topn_excess(line->duration, line->baseline);
+}
+
+static void swap(struct topn_line *a, struct topn_line *b) {
+	const struct topn_line tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/* Fill in a line, copying its text into the arena slot given, if there is one */
+static void set(const struct topn *t, struct topn_line *line, char *slot,
+                uint64_t duration, uint64_t baseline, uint64_t index,
+                bool err, const char *text, size_t len) {
+	line->duration = duration;
+	line->baseline = baseline;
+	line->index = index;
+	line->err = err;
+	if (slot) {
+		line->len = len < t->slot ? len : t->slot;
+		memcpy(slot, text, line->len);
+		line->text = slot;
+	} else {
+		line->len = len;
+		line->text = text;
+	}
+}
+
+void topn_add(struct topn *t, uint64_t duration, uint64_t baseline,
+              uint64_t index, bool err, const char *text, size_t len) {
+	if (t->len < t->size) {
+		/* Each line takes the next slot while filling up, then keeps it */
+		size_t i = t->len++;
+		set(t, t->lines + i, t->arena ? t->arena + i * t->slot : NULL,
+		    duration, baseline, index, err, text, len);
+
+		/* Sift up */
+		while (i && excess(t->lines + (i - 1) / 2) > excess(t->lines + i)) {
+			swap(t->lines + i, t->lines + (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	if (!topn_beats(t, duration, baseline)) {
+		return;
+	}
+
+	/* Replace the fastest, reusing its slot, then sift down */
+	set(t, t->lines, t->arena ? (char *)t->lines[0].text : NULL,
+	    duration, baseline, index, err, text, len);
+	size_t i = 0;
+	for (;;) {
+		const size_t l = i * 2 + 1, r = l + 1;
+		size_t min = i;
+		if (l < t->len && excess(t->lines + l) < excess(t->lines + min)) {
+			min = l;
+		}
+		if (r < t->len && excess(t->lines + r) < excess(t->lines + min)) {
+			min = r;
+		}
+		if (min == i) {
+			break;
+		}
+		swap(t->lines + i, t->lines + min);
+		i = min;
+	}
+}
+
+static int higher(const void *a, const void *b) {
+	const uint64_t x = excess(a);
+	const uint64_t y = excess(b);
+	return (x < y) - (x > y);
+}
+
+void topn_sort(struct topn *t) {
+	qsort(t->lines, t->len, sizeof(struct topn_line), higher);
+}
+
+void topn_print(struct topn *t, FILE *out) {
+	topn_sort(t);
+	for (size_t i = 0; i < t->len; i++) {
+		const struct topn_line *line = t->lines + i;
+		const struct timespec ts = timespec_from_nsec(line->duration);
+		fprintf(out, "%6lu.%06lu  line %-8llu %s  ", ts.tv_sec,
+		        ts.tv_nsec / NSEC_PER_USEC, (unsigned long long)line->index + 1,
+		        line->err ? "stderr" : "stdout");
+		fwrite(line->text, 1, line->len, out);
+		fputc('\n', out);
+	}
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The slowest lines seen so far, kept in a min-heap of a fixed size, so that
+ * each line costs a single comparison unless it beats the fastest of them.
+ *
+ * Their text is copied into an arena that is allocated up front, a slot for
+ * each entry, so that the memory used never grows however long a run goes on.
+ * Without an arena, the text is only pointed to, and has to outlive the heap,
+ * like that of a mapped recording.
+ *
+ * Lines can also be ranked by how much longer they took than they did in a
+ * baseline, rather than by how long they took, which is the same thing when
+ * there is no baseline to speak of.
+ */
+struct topn_line {
+	uint64_t duration;
+	/** How long the line took in the baseline, or 0 */
+	uint64_t baseline;
+	/** The line number, counting from 0 */
+	uint64_t index;
+	/** Whether stderr finished the line, rather than stdout */
+	bool err;
+	const char *text;
+	size_t len;
+};
+
+struct topn {
+	struct topn_line *lines;
+	size_t len;
+	size_t size;
+	/** A slot of slot bytes for each line's text, when they're copied */
+	char *arena;
+	size_t slot;
+};
+
+/* Keep the size slowest lines, and up to slot bytes of each one's text */
+void topn_init(struct topn *t, size_t size, size_t slot);
+void topn_destroy(struct topn *t);
+
+/* What a line is ranked by, which is never less than 0 */
+static inline uint64_t topn_excess(uint64_t duration, uint64_t baseline) {
+	return duration > baseline ? duration - baseline : 0;
+}
+
+/* Whether a line that took this long, against its baseline, would be kept */
+static inline bool topn_beats(const struct topn *t, uint64_t duration, uint64_t baseline) {
+	return t->len < t->size ||
+	       (t->size && topn_excess(duration, baseline) >
+	                   topn_excess(t->lines[0].duration, t->lines[0].baseline));
+}
+
+/* Keep a line, in place of the lowest ranked one kept, if it beats it. */
+void topn_add(struct topn *t, uint64_t duration, uint64_t baseline,
+              uint64_t index, bool err, const char *text, size_t len);
+
+/* Put the lines in order, highest ranked first, which leaves them no longer a heap */
+void topn_sort(struct topn *t);
+
+/*
+ * List the lines, slowest first, the same way that a report does. Sorting them
+ * leaves them no longer a heap, so this is only for once they're all in.
+ */
+void topn_print(struct topn *t, FILE *out);
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "trace.h"
+#include "linebuffer.h"
+
+#include <err.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <sysexits.h>
+
+/* How much of the trace gets buffered up before it's written out */
+#define TRACE_BUFFER (64 * 1024)
+
+/* The tracks of each process, as thread ids */
+#define TID_STDOUT   (1)
+#define TID_STDERR   (2)
+#define TID_SPANS    (3)
+
+struct tracer {
+	FILE *file;
+	/** Whether anything has been written yet, to know to separate it */
+	bool started;
+
+	/** Lines that open and close spans, when given */
+	regex_t begin;
+	regex_t end;
+	bool hasbegin;
+	bool hasend;
+
+	/** How many spans each process has open, indexed by pid */
+	unsigned *open;
+	size_t nopen;
+};
+
+/* Start the next event, separating it from the last one */
+static void event(struct tracer *t) {
+	fputs(t->started ? ",\n" : "[\n", t->file);
+	t->started = true;
+}
+
+/*
+ * Write a time in nanoseconds as the microseconds that the format expects.
+ * There are a couple of these for every line, so they skip printf.
+ */
+static void usec(FILE *f, uint64_t ns) {
+	char buf[32];
+	char *p = buf + sizeof(buf);
+	for (int i = 0; i < 3; i++, ns /= 10) {
+		*--p = (char)('0' + ns % 10);
+	}
+	*--p = '.';
+	do {
+		*--p = (char)('0' + ns % 10);
+	} while (ns /= 10);
+	fwrite(p, 1, (size_t)(buf + sizeof(buf) - p), f);
+}
+
+static void decimal(FILE *f, unsigned n) {
+	char buf[16];
+	char *p = buf + sizeof(buf);
+	do {
+		*--p = (char)('0' + n % 10);
+	} while (n /= 10);
+	fwrite(p, 1, (size_t)(buf + sizeof(buf) - p), f);
+}
+
+/*
+ * How many bytes long the UTF-8 character at text is, or 0 if it's invalid,
+ * including overlong forms, surrogates, and anything past U+10FFFF.
+ */
+static size_t utf8(const unsigned char *text, size_t len) {
+	const size_t need = text[0] >= 0xc2 && text[0] <= 0xdf ? 2 :
+	                    text[0] >= 0xe0 && text[0] <= 0xef ? 3 :
+	                    text[0] >= 0xf0 && text[0] <= 0xf4 ? 4 : 0;
+	if (!need || need > len) {
+		return 0;
+	}
+
+	/* Those are all down to the range of the second byte */
+	const unsigned char lo = text[0] == 0xe0 ? 0xa0 : text[0] == 0xf0 ? 0x90 : 0x80;
+	const unsigned char hi = text[0] == 0xed ? 0x9f : text[0] == 0xf4 ? 0x8f : 0xbf;
+	if (text[1] < lo || text[1] > hi) {
+		return 0;
+	}
+	for (size_t i = 2; i < need; i++) {
+		if ((text[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+	}
+	return need;
+}
+
+/*
+ * Write text as the inside of a JSON string. Escape codes are left out, since
+ * they mean nothing to a trace viewer, and so are other control characters.
+ * Invalid UTF-8 becomes a replacement character, to keep the file valid JSON.
+ */
+static void escape(FILE *f, const char *text, size_t len) {
+	const unsigned char *c = (const unsigned char *)text;
+	const unsigned char *end = c + len;
+
+	while (c < end) {
+		if (*c == '\x1b') {
+			c += lb_escape((const char *)c, (size_t)(end - c), 0);
+		} else if (*c == '\t') {
+			putc_unlocked(' ', f);
+			c++;
+		} else if (*c < 0x20 || *c == 0x7f) {
+			c++;
+		} else if (*c == '"' || *c == '\\') {
+			putc_unlocked('\\', f);
+			putc_unlocked(*c++, f);
+		} else if (*c < 0x80) {
+			putc_unlocked(*c++, f);
+		} else {
+			const size_t n = utf8(c, (size_t)(end - c));
+			if (n) {
+				fwrite(c, 1, n, f);
+				c += n;
+			} else {
+				fputs("\\ufffd", f);
+				c++;
+			}
+		}
+	}
+}
+
+static void quote(FILE *f, const char *text, size_t len) {
+	putc_unlocked('"', f);
+	escape(f, text, len);
+	putc_unlocked('"', f);
+}
+
+static void thread(struct tracer *t, unsigned pid, unsigned tid, const char *name) {
+	event(t);
+	fprintf(t->file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+	        "\"args\":{\"name\":\"%s\"}}", pid, tid, name);
+}
+
+struct tracer *trace_open(const char *path) {
+	struct tracer *t = calloc(sizeof(struct tracer), 1);
+	if (!t) {
+		err(EX_OSERR, "malloc");
+	}
+
+	if (!(t->file = fopen(path, "w"))) {
+		err(EX_CANTCREAT, "%s", path);
+	}
+	setvbuf(t->file, NULL, _IOFBF, TRACE_BUFFER);
+
+	return t;
+}
+
+void trace_close(struct tracer *t, uint64_t end) {
+	/* Spans that never saw their end marker end with the run */
+	for (size_t pid = 0; pid < t->nopen; pid++) {
+		for (; t->open[pid]; t->open[pid]--) {
+			event(t);
+			fprintf(t->file, "{\"ph\":\"E\",\"ts\":");
+			usec(t->file, end);
+			fprintf(t->file, ",\"pid\":%zu,\"tid\":%u}", pid, TID_SPANS);
+		}
+	}
+
+	fputs(t->started ? "\n]\n" : "[]\n", t->file);
+	if (fclose(t->file) == EOF) {
+		err(EX_IOERR, "fclose");
+	}
+
+	if (t->hasbegin) {
+		regfree(&t->begin);
+	}
+	if (t->hasend) {
+		regfree(&t->end);
+	}
+	free(t->open);
+	free(t);
+}
+
+static bool compile(regex_t *re, const char *pattern) {
+	const int error = regcomp(re, pattern, REG_EXTENDED);
+	if (error) {
+		char message[128];
+		regerror(error, re, message, sizeof(message));
+		warnx("Invalid pattern: %s: %s", pattern, message);
+		return false;
+	}
+	return true;
+}
+
+bool trace_markers(struct tracer *t, const char *begin, const char *end) {
+	if (begin && !(t->hasbegin = compile(&t->begin, begin))) {
+		return false;
+	}
+	if (end && !(t->hasend = compile(&t->end, end))) {
+		return false;
+	}
+	return true;
+}
+
+void trace_process(struct tracer *t, unsigned pid, char * const argv[]) {
+	event(t);
+	fprintf(t->file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+	        "\"args\":{\"name\":\"", pid);
+	for (char * const *arg = argv; *arg; arg++) {
+		if (arg != argv) {
+			putc_unlocked(' ', t->file);
+		}
+		escape(t->file, *arg, strlen(*arg));
+	}
+	fputs("\"}}", t->file);
+
+	thread(t, pid, TID_STDOUT, "stdout");
+	thread(t, pid, TID_STDERR, "stderr");
+	thread(t, pid, TID_SPANS, "spans");
+
+	if (pid >= t->nopen) {
+		const size_t nopen = pid + 1;
+		if (!(t->open = realloc(t->open, nopen * sizeof(*t->open)))) {
+			err(EX_OSERR, "realloc");
+		}
+		memset(t->open + t->nopen, 0, (nopen - t->nopen) * sizeof(*t->open));
+		t->nopen = nopen;
+	}
+}
+
+/* Whether a line matches a marker, and where its first subexpression is */
+static bool marker(const regex_t *re, const char *text, size_t len, regmatch_t match[2]) {
+	match[0].rm_so = 0;
+	match[0].rm_eo = (regoff_t)len;
+	return !regexec(re, text, 2, match, REG_STARTEND);
+}
+
+void trace_line(struct tracer *t, unsigned pid, bool errstream,
+                const char *text, size_t len, uint64_t start, uint64_t duration) {
+	event(t);
+	fputs("{\"name\":", t->file);
+	quote(t->file, text, len);
+	fputs(errstream ? ",\"cat\":\"stderr\",\"ph\":\"X\",\"ts\":" :
+	                  ",\"cat\":\"stdout\",\"ph\":\"X\",\"ts\":", t->file);
+	usec(t->file, start);
+	fputs(",\"dur\":", t->file);
+	usec(t->file, duration);
+	fputs(",\"pid\":", t->file);
+	decimal(t->file, pid);
+	fputs(",\"tid\":", t->file);
+	decimal(t->file, errstream ? TID_STDERR : TID_STDOUT);
+	fputs(errstream ? ",\"cname\":\"bad\"}" : "}", t->file);
+
+	/* Spans start and end as of when their marker lines are done */
+	const uint64_t done = start + duration;
+	regmatch_t match[2];
+	if (t->hasend && t->open[pid] && marker(&t->end, text, len, match)) {
+		event(t);
+		fputs("{\"ph\":\"E\",\"ts\":", t->file);
+		usec(t->file, done);
+		fprintf(t->file, ",\"pid\":%u,\"tid\":%u}", pid, TID_SPANS);
+		t->open[pid]--;
+	}
+	if (t->hasbegin && marker(&t->begin, text, len, match)) {
+		/* A subexpression names the span, otherwise the whole line does */
+		const bool sub = t->begin.re_nsub && match[1].rm_so != -1;
+		event(t);
+		fputs("{\"name\":", t->file);
+		quote(t->file, text + (sub ? match[1].rm_so : 0),
+		      sub ? (size_t)(match[1].rm_eo - match[1].rm_so) : len);
+		fputs(",\"cat\":\"span\",\"ph\":\"B\",\"ts\":", t->file);
+		usec(t->file, done);
+		fprintf(t->file, ",\"pid\":%u,\"tid\":%u}", pid, TID_SPANS);
+		t->open[pid]++;
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018 Daniel Loffgren
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A trace is every line's timing, written out in the Trace Event Format as it
+ * goes, for loading into Perfetto or chrome://tracing. Each job is a process
+ * with a track of complete events for each of its streams, and a third track
+ * of spans, which lines matching the begin and end markers open and close.
+ *
+ * It's written as a bare JSON array, which the format allows to be left
+ * unterminated, so that a trace of a run that never finished still loads.
+ */
+
+struct tracer;
+
+struct tracer *trace_open(const char *path);
+
+/* Close any spans that are still open as of the end, and finish the file. */
+void trace_close(struct tracer *t, uint64_t end);
+
+/*
+ * Compile the patterns for lines that begin and end spans, either of which may
+ * be NULL. Returns false if one isn't valid.
+ */
+bool trace_markers(struct tracer *t, const char *begin, const char *end);
+
+/* Name a job's process and its tracks after its command. */
+void trace_process(struct tracer *t, unsigned pid, char * const argv[]);
+
+/*
+ * Finish a line from stdout or stderr, as an event named after its text,
+ * starting that long after the run started and lasting as long as the line
+ * took, both in nanoseconds.
+ */
+void trace_line(struct tracer *t, unsigned pid, bool errstream,
+                const char *text, size_t len, uint64_t start, uint64_t duration);
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+
+# Print what a metrics socket serves, once it's there
+
+from time import sleep
+import socket
+import sys
+
+for attempt in range(50):
+    try:
+        s = socket.socket(socket.AF_UNIX)
+        s.connect(sys.argv[1])
+        break
+    except OSError:
+        sleep(.1)
+
+s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+while True:
+    data = s.recv(4096)
+    if not data:
+        break
+    sys.stdout.write(data.decode())